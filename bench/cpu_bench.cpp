@@ -0,0 +1,48 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "cartridge.hpp"
+#include "frame_sink.hpp"
+#include "gameboy.hpp"
+
+// Measures emulated instructions/sec on the Blargg CPU test ROM - the default frame
+// count is just enough for all of its sub-tests to finish
+// Usage: ./cpu_bench [rom] [frames] [--no-jit]
+int main(int argc, char* argv[]) {
+    std::string fileName = GAMEBOY_TEST_ROM_DIR "/cpu_instrs.gb";
+    long numFrames = 3500;
+    bool useJit = true;
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--no-jit") {
+            useJit = false;
+        } else if (positional++ == 0) {
+            fileName = arg;
+        } else {
+            numFrames = std::stol(arg);
+        }
+    }
+
+    Cartridge cartridge(readRomFile(fileName), fileName);
+    NullFrameSink sink;
+    Gameboy emu(cartridge, sink);
+    emu.setJitEnabled(useJit);
+
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < numFrames; i++) {
+        emu.runFrame();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    uint64_t instructions = emu.getInstructionCount();
+    std::cout << "Ran " << instructions << " instructions (" << numFrames << " frames) in "
+              << seconds << " s" << std::endl;
+    std::cout << instructions / seconds / 1e6 << " M instructions/sec ("
+              << (numFrames / seconds) / Gameboy::FRAME_RATE << "x real time)" << std::endl;
+    std::cout << "Serial output:" << std::endl << emu.getSerialOutput() << std::endl;
+    return 0;
+}
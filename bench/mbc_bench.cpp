@@ -0,0 +1,89 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cartridge.hpp"
+#include "frame_sink.hpp"
+#include "gameboy.hpp"
+#include "mmu.hpp"
+
+// Measures banked ROM access on a synthetic 512 KB MBC1 cartridge: once as raw MMU
+// bank switches and reads, and once as a CPU loop that switches to every bank in turn
+// and sums 64 bytes from it
+std::vector<uint8_t> buildRom() {
+    std::vector<uint8_t> rom(512 * 1024);
+    for (size_t i = 0; i < rom.size(); i++) {
+        rom[i] = static_cast<uint8_t>(i * 31 + i / 0x4000);
+    }
+    rom[0x0147] = 0x01; // MBC1
+    rom[0x0148] = 0x04; // 512 KB
+    rom[0x0149] = 0x00;
+
+    const std::vector<uint8_t> entry = {
+        0x00, 0xC3, 0x50, 0x01, // nop; jp 0x0150
+    };
+    const std::vector<uint8_t> program = {
+        0xF3,             // di
+        0x06, 0x01,       // ld b, 1
+        0x78,             // loop: ld a, b
+        0xEA, 0x00, 0x20, // ld (0x2000), a - select ROM bank
+        0x21, 0x00, 0x40, // ld hl, 0x4000
+        0x0E, 0x40,       // ld c, 64
+        0x2A,             // inner: ld a, (hl+)
+        0x82,             // add a, d
+        0x57,             // ld d, a
+        0x0D,             // dec c
+        0x20, 0xFA,       // jr nz, inner
+        0x04,             // inc b
+        0x78,             // ld a, b
+        0xE6, 0x1F,       // and 0x1F
+        0x20, 0x01,       // jr nz, +1
+        0x3C,             // inc a - bank 0 selects bank 1 anyway
+        0x47,             // ld b, a
+        0x18, 0xE7,       // jr loop
+    };
+    std::copy(entry.begin(), entry.end(), rom.begin() + 0x0100);
+    std::copy(program.begin(), program.end(), rom.begin() + 0x0150);
+    return rom;
+}
+
+int main(int argc, char* argv[]) {
+    long numFrames = argc >= 2 ? std::stol(argv[1]) : 2000;
+
+    {
+        Cartridge cartridge(buildRom(), "synthetic");
+        Scheduler scheduler;
+        MMU mmu(cartridge, scheduler);
+
+        const int switches = 2000000;
+        uint32_t checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < switches; i++) {
+            mmu.write(0x2000, static_cast<uint8_t>(1 + i % 31));
+            uint16_t base = 0x4000 + (i * 64) % 0x4000;
+            for (uint16_t offset = 0; offset < 64; offset++) {
+                checksum += mmu.read(base + offset);
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "MMU: " << switches / seconds / 1e6 << " M bank switches/sec with 64 reads each (checksum "
+                  << checksum << ")" << std::endl;
+    }
+
+    {
+        Cartridge cartridge(buildRom(), "synthetic");
+        NullFrameSink sink;
+        Gameboy emu(cartridge, sink);
+
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < numFrames; i++) {
+            emu.runFrame();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "CPU: " << emu.getInstructionCount() / seconds / 1e6 << " M instructions/sec ("
+                  << (numFrames / seconds) / Gameboy::FRAME_RATE << "x real time)" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cartridge.hpp"
+#include "mmu.hpp"
+
+// Compares MMU::read through the page table against the old region lookup
+// on an instruction fetch heavy access pattern
+int main(int argc, char* argv[]) {
+    std::vector<uint8_t> romData;
+    std::string fileName = "synthetic";
+    if (argc >= 2) {
+        fileName = argv[1];
+        romData = readRomFile(fileName);
+    } else {
+        // 64 KB MBC1 ROM without RAM
+        romData.resize(0x10000);
+        for (size_t i = 0; i < romData.size(); i++) {
+            romData[i] = static_cast<uint8_t>(i * 31);
+        }
+        romData[0x0147] = 0x01;
+        romData[0x0149] = 0x00;
+    }
+
+    Cartridge cartridge(std::move(romData), fileName);
+    Scheduler scheduler;
+    MMU mmu(cartridge, scheduler);
+
+    // Mostly sequential ROM fetches with some WRAM, HRAM and IO traffic mixed in
+    std::vector<uint16_t> addresses(1 << 16);
+    std::mt19937 rng(1234);
+    uint16_t pc = 0x0150;
+    for (uint16_t& address : addresses) {
+        uint32_t kind = rng() % 100;
+        if (kind < 70) {
+            address = pc;
+            pc = (pc + 1) & 0x7FFF;
+        } else if (kind < 85) {
+            address = 0xC000 + rng() % 0x2000;
+        } else if (kind < 95) {
+            address = 0xFF80 + rng() % 0x7F;
+        } else {
+            address = 0xFF40 + rng() % 0x0C;
+        }
+    }
+
+    const int passes = 500;
+    auto measure = [&](const char* name, auto readFn) {
+        uint32_t checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < passes; pass++) {
+            for (uint16_t address : addresses) {
+                checksum += readFn(address);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(end - start).count();
+        double readsPerSecond = (static_cast<double>(passes) * addresses.size()) / seconds;
+        std::cout << name << ": " << readsPerSecond / 1e6 << " M reads/sec (checksum "
+                  << checksum << ")" << std::endl;
+        return readsPerSecond;
+    };
+
+    double regionRate = measure("region lookup", [&](uint16_t address) { return mmu.readRegion(address); });
+    double pageRate = measure("page table   ", [&](uint16_t address) { return mmu.read(address); });
+    std::cout << "speedup: " << pageRate / regionRate << "x" << std::endl;
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cartridge.hpp"
+#include "frame_sink.hpp"
+#include "mmu.hpp"
+#include "ppu.hpp"
+#include "scheduler.hpp"
+#include "tile_decode.hpp"
+
+// Measures how many full frames of scanlines the PPU renders per second with the
+// background, window and sprites all enabled over random VRAM and OAM contents, with
+// the scanline renderer and the pixel FIFO side by side.
+// --busy-sprites packs OAM into two bands of 20 sprites each, twice the line limit
+// Usage: ./render_bench [frames] [--busy-sprites]
+int main(int argc, char* argv[]) {
+    long numFrames = 2000;
+    bool busySprites = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--busy-sprites") {
+            busySprites = true;
+        } else {
+            numFrames = std::stol(arg);
+        }
+    }
+
+    // 32 KB ROM only cartridge - the renderer never touches it
+    std::vector<uint8_t> romData(0x8000);
+    Cartridge cartridge(std::move(romData), "synthetic");
+    Scheduler scheduler;
+    MMU mmu(cartridge, scheduler);
+
+    std::mt19937 rng(1234);
+    for (uint16_t address = 0x8000; address <= 0x9FFF; address++) {
+        mmu.write(address, static_cast<uint8_t>(rng()));
+    }
+    for (uint16_t address = 0xFE00; address <= 0xFE9F; address++) {
+        mmu.write(address, static_cast<uint8_t>(rng()));
+    }
+    if (busySprites) {
+        for (uint16_t sprite = 0; sprite < 40; sprite++) {
+            uint16_t address = 0xFE00 + sprite * 4;
+            mmu.write(address, static_cast<uint8_t>(40 + (sprite / 20) * 64 + sprite % 4)); // Y
+            mmu.write(address + 1, static_cast<uint8_t>(8 + (sprite % 20) * 8));           // X
+        }
+    }
+
+    mmu.write(0xFF40, 0xF3); // LCD, window, sprites and background on
+    mmu.write(0xFF42, 5);    // SCY
+    mmu.write(0xFF43, 3);    // SCX
+    mmu.write(0xFF4A, 60);   // WY
+    mmu.write(0xFF4B, 47);   // WX
+    mmu.write(0xFF47, 0xE4); // BGP
+    mmu.write(0xFF48, 0xD2); // OBP0
+    mmu.write(0xFF49, 0x1B); // OBP1
+
+    std::cout << "Tile decoding: " << TileDecode::IMPLEMENTATION << std::endl;
+
+    // The last frame of each renderer is kept to check they agree
+    NullFrameSink sink;
+    FrameBuffer frames[2];
+    const PPU_RENDERER renderers[2] = {PPU_RENDERER::SCANLINE, PPU_RENDERER::PIXEL_FIFO};
+    const char* names[2] = {"Scanline", "Pixel FIFO"};
+    for (int i = 0; i < 2; i++) {
+        // Each PPU starts with an empty tile cache
+        mmu.getDirtyTiles().markAll();
+        PPU ppu(mmu, sink, scheduler);
+        ppu.setRenderer(renderers[i]);
+
+        auto start = std::chrono::steady_clock::now();
+        for (long frame = 0; frame < numFrames; frame++) {
+            for (uint8_t line = 0; line < SCREEN_HEIGHT; line++) {
+                mmu.write(0xFF44, line); // LY
+                ppu.scanOAM();
+                ppu.drawScanline();
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        frames[i] = ppu.getFrameRing().publish();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        std::cout << names[i] << ": rendered " << numFrames << " frames in " << seconds << " s, "
+                  << numFrames / seconds << " frames/sec ("
+                  << numFrames * SCREEN_HEIGHT / seconds / 1e6 << " M scanlines/sec)" << std::endl;
+    }
+
+    bool identical = std::memcmp(frames[0].data(), frames[1].data(), frames[0].size()) == 0;
+    std::cout << "Output " << (identical ? "identical" : "DIFFERS") << std::endl;
+    return identical ? 0 : 1;
+}
@@ -3,10 +3,13 @@
 #include <cstdint>
 #include <string>
 #include <vector>
+#include <type_traits>
 #include <iostream>
 #include <memory>
 
+#include "mapped_file.hpp"
 #include "mbc.hpp"
+#include "span.hpp"
 
 constexpr size_t ROM_BANK_SIZE = 32768;
 constexpr size_t KILOBYTE_SIZE = 1024;
@@ -16,66 +19,135 @@ enum class MBCType {
     MBC1,
     MBC1_WITH_RAM,
     MBC2,
+    MBC3,
+    MBC5,
     UNSUPPORTED
 };
 
+// Reads an entire ROM image from disk
+std::vector<uint8_t> readRomFile(const std::string& fileName);
+
 class Cartridge {
 private:
-    std::vector<uint8_t> rom;
-    std::vector<uint8_t> ram;
+    // The ROM is romBuffer or the read-only mapping of the ROM file, rom points at
+    // whichever it is
+    std::vector<uint8_t> romBuffer;
+    std::unique_ptr<MappedFile> romFile;
+    Span<const uint8_t> rom;
+    // External RAM is ramBuffer, or the mapped save file once a battery backed
+    // cartridge has opened one. ram points at whichever it is
+    std::vector<uint8_t> ramBuffer;
+    std::unique_ptr<MappedFile> saveFile;
+    Span<uint8_t> ram;
+    // The MBC3 clock's part of the save file, empty without one
+    Span<uint8_t> rtcFooter;
     std::string title;
     size_t romSize;
     size_t ramSize;
     std::string filename; // Add filename as a member variable
 
     MBCType mbcType;
-    unique_ptr<MBC> mbc;
+    bool battery;
+    bool rtc;
+    // What the MBC3 clock counts cycles of
+    const Scheduler* clock{nullptr};
+    // Picked once from the header, calls to it are a switch on the variant's index
+    Mapper mbc;
 
+    // Reads the header and sets up the RAM and MBC once rom is set
+    void initialize();
     MBCType getMBCType(uint8_t code);
-    unique_ptr<MBC> getMBC(MBCType mbcType);
+    bool hasBattery(uint8_t code);
+    bool hasRtc(uint8_t code);
+    // Builds the mapper for mbcType over the current rom and ram
+    void createMapper();
+    // Throws std::runtime_error for codes the header format does not define
     size_t getRamSize(uint8_t code);
     std::string getMBCString(MBCType mbcType);
 
 public:
+    static constexpr size_t MBC2_RAM_SIZE = 512;
+
+    // Takes a ROM image that is already in memory
     explicit Cartridge(std::vector<uint8_t>&& romData, const std::string& filename) :
-        filename(filename) {
-        // Extract info from cartridge
-        rom = std::move(romData);
-        title.assign(rom.begin() + 0x0134, rom.begin() + 0x0143);
-        romSize = rom.size();
-        ramSize = getRamSize(rom.at(0x0149));
-        ram.resize(ramSize, 0);
-
-        // Initialize MBC
-        mbcType = getMBCType(rom.at(0x0147));
-        mbc = getMBC(mbcType);
+        romBuffer(std::move(romData)), rom(romBuffer), filename(filename) {
+        initialize();
     }
 
+    // Maps the ROM file instead of reading it - nothing is copied, and every instance
+    // of the same ROM on the host shares the page cache's copy. Throws
+    // std::runtime_error if the file can't be mapped
+    explicit Cartridge(const std::string& filename) :
+        romFile(std::make_unique<MappedFile>(filename)), rom(romFile->data(), romFile->size()), filename(filename) {
+        initialize();
+    }
+
+    // Moving a vector keeps its storage and mappings never move, so rom and ram - and the
+    // mapper's views of them - stay valid. The mapper keeps its bank selection
     Cartridge(Cartridge&& other) noexcept :
-        rom(std::move(other.rom)),
-        ram(std::move(other.ram)),
+        romBuffer(std::move(other.romBuffer)),
+        romFile(std::move(other.romFile)),
+        rom(other.rom),
+        ramBuffer(std::move(other.ramBuffer)),
+        saveFile(std::move(other.saveFile)),
+        ram(other.ram),
+        rtcFooter(other.rtcFooter),
         title(std::move(other.title)),
         romSize(other.romSize),
         ramSize(other.ramSize),
         filename(std::move(other.filename)),
-        mbcType(other.mbcType) {
-        mbc = getMBC(other.mbcType);
-    }
+        mbcType(other.mbcType),
+        battery(other.battery),
+        rtc(other.rtc),
+        clock(other.clock),
+        mbc(std::move(other.mbc)) {}
 
     Cartridge& operator=(Cartridge&& other) noexcept {
         if (this != &other) {
-            rom = std::move(other.rom);
-            ram = std::move(other.ram);
+            romBuffer = std::move(other.romBuffer);
+            romFile = std::move(other.romFile);
+            rom = other.rom;
+            ramBuffer = std::move(other.ramBuffer);
+            saveFile = std::move(other.saveFile);
+            ram = other.ram;
+            rtcFooter = other.rtcFooter;
             title = std::move(other.title);
             romSize = other.romSize;
             ramSize = other.ramSize;
             filename = std::move(other.filename);
             mbcType = other.mbcType;
-            mbc = getMBC(other.mbcType);
+            battery = other.battery;
+            rtc = other.rtc;
+            clock = other.clock;
+            // The mappers can't be assigned to, so the moved one is constructed in place
+            std::visit([this](auto& mapper) { mbc.emplace<std::decay_t<decltype(mapper)>>(std::move(mapper)); },
+                       other.mbc);
         }
         return *this;
     }
 
+    // Battery backed RAM: maps <rom name>.sav next to the ROM and uses it as the external
+    // RAM from then on, so every write lands in the file. An MBC3 clock is kept in a
+    // footer after the RAM. Must be called before a Gameboy is built on the cartridge.
+    // Returns false if the cartridge has nothing battery backed, throws
+    // std::runtime_error if the file can't be mapped
+    bool openSaveFile();
+    // Forces the save file to disk, a no-op without one
+    void syncSaveFile() {
+        if (saveFile) {
+            saveFile->sync();
+        }
+    }
+    bool hasSaveFile() const { return saveFile != nullptr; }
+
+    // The MBC3 clock runs on the scheduler's cycle count, it stands still while null
+    void setClock(const Scheduler* scheduler) {
+        clock = scheduler;
+        if (auto* mbc3 = std::get_if<MBC3>(&mbc)) {
+            mbc3->setClockSource(scheduler);
+        }
+    }
+
     void printInfo() {
         std::cout << "Title: " << title << std::endl;
         std::cout << "MBC Type: " << getMBCString(mbcType) << std::endl;
@@ -84,10 +156,31 @@ public:
     }
 
     void write(uint16_t address, uint8_t value) {
-        mbc->write(address, value);
+        std::visit([&](auto& mapper) { mapper.write(address, value); }, mbc);
     }
 
     uint8_t read(uint16_t address) {
-        return mbc->read(address);
+        return std::visit([&](const auto& mapper) { return mapper.read(address); }, mbc);
+    }
+
+    const uint8_t* romBank0() const { return std::visit([](const auto& mapper) { return mapper.romBank0(); }, mbc); }
+    const uint8_t* romBankN() const { return std::visit([](const auto& mapper) { return mapper.romBankN(); }, mbc); }
+    uint8_t* ramBank() { return std::visit([](auto& mapper) { return mapper.ramBank(); }, mbc); }
+
+    // All external RAM banks, empty if the cartridge has none
+    Span<const uint8_t> getRam() const { return Span<const uint8_t>(ram.data(), ram.size()); }
+
+    const std::string& getTitle() const { return title; }
+    // Header and global checksums (0x14D-0x14F), to tell ROMs with the same title apart
+    uint32_t getChecksum() const { return (rom.at(0x14D) << 16) | (rom.at(0x14E) << 8) | rom.at(0x14F); }
+
+    void saveState(StateWriter& state) const {
+        state.writeBytes(ram.data(), ram.size());
+        std::visit([&](const auto& mapper) { mapper.saveState(state); }, mbc);
+    }
+
+    void loadState(StateReader& state) {
+        state.readBytes(ram.data(), ram.size());
+        std::visit([&](auto& mapper) { mapper.loadState(state); }, mbc);
     }
 };
@@ -1,10 +1,25 @@
 #pragma once
+#include <array>
+#include <cassert>
+#include <cstddef>
 #include <iomanip>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "mmu.hpp"
 #include "register_types.hpp"
 #include <iostream>
 
+class CPU;
+class JitCompiler;
+
+// Runs a compiled block from its first instruction until the block ends, a branch is
+// taken, a write has side effects outside plain RAM or the cycle budget is used up.
+// Leaves PC at the next instruction to execute and returns the cycles taken
+using JitFunction = int (*)(CPU* cpu, int cycleBudget);
+
 struct Registers {
     uint8_t A;
     uint8_t F;
@@ -28,11 +43,14 @@ struct Registers {
 
 class CPU {
 private:
+    friend class JitCompiler;
+
     Registers registers = Registers();
     uint16_t PC{0x100};
     uint16_t SP{0xFFE};
 
     MMU& bus;
+    uint64_t instructionCount{0};
     bool halted{false};
     bool interruptsEnabled{true};
     bool enableInterruptsNextInstruction{false};
@@ -40,22 +58,22 @@ private:
     // Getters & Setters
 
     // r8
-    R8 getR8(uint8_t registerNum);
+    static constexpr R8 getR8(uint8_t registerNum);
     uint8_t getR8Value(R8 r8);
     void setR8Value(R8 r8, uint8_t value);
 
     // r16
-    R16 getR16(uint8_t registerNum);
+    static constexpr R16 getR16(uint8_t registerNum);
     uint16_t getR16Value(R16 r16);
     void setR16Value(R16 r16, uint16_t value);
 
     // [r16mem]
-    R16MEM getR16MEM(uint8_t registerNum);
+    static constexpr R16MEM getR16MEM(uint8_t registerNum);
     uint8_t getR16MEMValue(R16MEM r16);
     void setR16MEMValue(R16MEM r16Mem, uint8_t value);
 
     // r16stk
-    R16STK getR16STK(uint8_t registerNum);
+    static constexpr R16STK getR16STK(uint8_t registerNum);
     uint16_t getR16STKValue(R16STK r16Mem);
     void setR16STKValue(R16STK r16Mem, uint16_t value);
 
@@ -80,15 +98,105 @@ private:
     void pushStack(uint8_t value);
     uint8_t popStack();
 
+    // Dispatch
+    // Each opcode gets its own handler, instantiated from the opcode's bit pattern so
+    // register operands are resolved at compile time. Handlers take the instruction's
+    // immediate bytes (already fetched) and return the cycles taken
+    using Handler = int (CPU::*)(uint16_t operand);
+
+    static const std::array<Handler, 256> OPCODE_TABLE;
+    static const std::array<Handler, 256> CB_TABLE;
+    static const std::array<uint8_t, 256> OPCODE_LENGTHS;
+
+    template <size_t... OPCODES>
+    static constexpr std::array<Handler, 256> buildOpcodeTable(std::index_sequence<OPCODES...>);
+    template <size_t... OPCODES>
+    static constexpr std::array<Handler, 256> buildCBTable(std::index_sequence<OPCODES...>);
+    template <size_t... OPCODES>
+    static constexpr std::array<uint8_t, 256> buildOpcodeLengths(std::index_sequence<OPCODES...>);
+
+    template <R8 r8> uint8_t readR8();
+    template <R8 r8> void writeR8(uint8_t value);
+    uint16_t fetchOperand(uint8_t length);
+
+    template <uint8_t OPCODE> int execute(uint16_t operand);
+    template <uint8_t OPCODE> int executeCB(uint16_t operand);
+    template <uint8_t OPERATION> void executeALU(uint8_t value);
+    int executeInvalid();
+
+    // Block cache
+    // Straight-line runs of ROM code are decoded once into handler + operand pairs,
+    // keyed by their location in ROM so every bank gets its own blocks. The address
+    // is part of the key too - MBCs can map the same bank at 0x0000 and 0x4000, and
+    // compiled blocks have their PC values built in. Blocks run
+    // through not-taken conditional branches and end at unconditional control flow.
+    // Code outside ROM (WRAM, HRAM...) may be modified so it is always interpreted
+    struct DecodedInstruction {
+        Handler handler;
+        uint16_t operand; // For 0xCB this is the second opcode byte
+        uint8_t opcode;
+        uint8_t length;
+    };
+    struct DecodedBlock {
+        std::vector<DecodedInstruction> instructions;
+#ifdef GAMEBOY_JIT
+        uint32_t executionCount{0};
+        JitFunction jitCode{nullptr};
+#endif
+    };
+    static constexpr size_t MAX_BLOCK_INSTRUCTIONS = 64;
+
+    struct BlockKey {
+        const uint8_t* code;
+        uint16_t address;
+        bool operator==(const BlockKey& other) const { return code == other.code && address == other.address; }
+    };
+    struct BlockKeyHash {
+        // The low address bits repeat the code pointer's, only the ROM half differs
+        size_t operator()(const BlockKey& key) const {
+            return std::hash<const uint8_t*>()(key.code) ^ (key.address >> 14);
+        }
+    };
+    std::unordered_map<BlockKey, DecodedBlock, BlockKeyHash> blockCache;
+    DecodedBlock* currentBlock{nullptr};
+    size_t blockPosition{0};
+    uint16_t blockPC{0}; // Address of the next instruction in currentBlock
+    uint32_t blockMappingVersion{0};
+
+    static bool endsBlock(uint8_t opcode);
+    DecodedBlock* findBlock(uint16_t address);
+    int executeNext(int cycleBudget);
+
+#ifdef GAMEBOY_JIT
+    // JIT
+    // Blocks are compiled once they have run JIT_COMPILE_THRESHOLD times. Compiled
+    // blocks stop once they use up the cycles left until the next scheduled event
+    using Thunk = int (*)(CPU* cpu, uint16_t operand);
+    static constexpr uint32_t JIT_COMPILE_THRESHOLD = 16;
+
+    static const std::array<Thunk, 256> OPCODE_THUNKS;
+    static const std::array<Thunk, 256> CB_THUNKS;
+
+    template <uint8_t OPCODE> static int executeThunk(CPU* cpu, uint16_t operand);
+    template <uint8_t OPCODE> static int executeCBThunk(CPU* cpu, uint16_t operand);
+    template <size_t... OPCODES>
+    static constexpr std::array<Thunk, 256> buildThunkTable(std::index_sequence<OPCODES...>);
+    template <size_t... OPCODES>
+    static constexpr std::array<Thunk, 256> buildCBThunkTable(std::index_sequence<OPCODES...>);
+
+    std::unique_ptr<JitCompiler> jit;
+    bool jitEnabled{true};
+
+    JitFunction getJitCode(DecodedBlock& block, uint16_t address);
+#endif
+
 public:
-    int cycle();
+    // Runs the next instruction, or a whole compiled block of up to cycleBudget
+    // cycles when the JIT is enabled, and returns the cycles taken. A halted CPU
+    // sleeps through the whole budget in one call, so it should end at the next event
+    int cycle(int cycleBudget);
     void handleInterrupts();
     int executeInstruction(uint8_t opcode);
-    int executeBlock0(uint8_t opcode);
-    int executeBlock1(uint8_t opcode);
-    int executeBlock2(uint8_t opcode);
-    int executeBlock3(uint8_t opcode);
-    int executeBlockCB(uint8_t opcode);
 
     // Block 0 opcodes
     void NOOP();
@@ -161,7 +269,78 @@ public:
     void RES(uint8_t n, R8 reg);
     void SET(uint8_t n, R8 reg);
 
-    explicit CPU(MMU& bus): bus(bus) {}
+    explicit CPU(MMU& bus);
+    ~CPU();
+    CPU(const CPU&) = delete;
+    CPU& operator=(const CPU&) = delete;
+
+    uint64_t getInstructionCount() const { return instructionCount; }
+
+    // Registers and interrupt state. Decoded and compiled blocks are kept - they only
+    // depend on the ROM
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+
+    // Only has an effect when built with GAMEBOY_JIT
+    void setJitEnabled(bool enabled);
     void run();
     void printInfo();
 };
+
+// Operand decoding, shared with the JIT
+constexpr R8 CPU::getR8(uint8_t registerNum) {
+    assert(registerNum < 8);
+    switch (registerNum) {
+        case 0: return R8::B;
+        case 1: return R8::C;
+        case 2: return R8::D;
+        case 3: return R8::E;
+        case 4: return R8::H;
+        case 5: return R8::L;
+        case 6: return R8::HL_ADDR;
+        case 7: return R8::A;
+        default:
+            assert(false && "Invalid R8 index");
+            return R8::A;
+    }
+}
+
+constexpr R16 CPU::getR16(uint8_t registerNum) {
+    assert(registerNum < 4);
+    switch (registerNum) {
+        case 0: return R16::BC;
+        case 1: return R16::DE;
+        case 2: return R16::HL;
+        case 3: return R16::SP;
+        default:
+            assert(false && "Invalid R16 index");
+            return R16::SP;
+    }
+}
+
+constexpr R16MEM CPU::getR16MEM(uint8_t registerNum) {
+    assert(registerNum < 4);
+    // BC, DE, HLI, HLD
+    switch (registerNum) {
+        case 0: return R16MEM::BC;
+        case 1: return R16MEM::DE;
+        case 2: return R16MEM::HLI;
+        case 3: return R16MEM::HLD;
+        default:
+            assert(false && "Invalid R16MEM index");
+            return R16MEM::HLD;
+    }
+}
+
+constexpr R16STK CPU::getR16STK(uint8_t registerNum) {
+    assert(registerNum < 4);
+    switch (registerNum) {
+        case 0: return R16STK::BC;
+        case 1: return R16STK::DE;
+        case 2: return R16STK::HL;
+        case 3: return R16STK::AF;
+        default:
+            assert(false && "Invalid R16STK index");
+            return R16STK::AF;
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <SDL2/SDL.h>
+
+#include "frame_sink.hpp"
+
+// SDL window showing frames taken from the emulator's FrameRing
+class Display {
+private:
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+    SDL_Texture* texture;
+
+public:
+    Display();
+    ~Display();
+
+    // Uploads and shows a frame - blocks on vsync, so it runs apart from emulation
+    void present(const FrameBuffer& buffer);
+    void setTitle(const char* title);
+};
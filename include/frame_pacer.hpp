@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Holds emulation to the Game Boy's frame rate, scaled by a speed multiplier
+//
+// Called once per emulated frame from the emulation thread. The speed and throttling
+// can be changed from any thread, and the measured speed read from any thread
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr double MIN_SPEED = 0.25;
+    static constexpr double MAX_SPEED = 8.0;
+
+private:
+    // OS sleeps overshoot by up to about a millisecond, so the last stretch is spent
+    // yielding instead
+    static constexpr std::chrono::microseconds SPIN_TIME{1500};
+    // Further behind than this (a stall, the window being dragged...) the pacer gives
+    // up on the lost time instead of running flat out to catch up
+    static constexpr std::chrono::milliseconds MAX_LAG{100};
+    // How often the measured speed is updated
+    static constexpr std::chrono::milliseconds MEASURE_INTERVAL{500};
+
+    double framesPerSecond;
+    std::atomic<double> speed{1.0};
+    std::atomic<bool> throttled{true};
+    std::atomic<bool> fastForward{false};
+
+    Clock::time_point nextFrame;
+    Clock::time_point measureStart;
+    int framesMeasured{0};
+    std::atomic<double> measuredSpeed{0.0};
+
+    void updateMeasurement(Clock::time_point now);
+
+public:
+    explicit FramePacer(double framesPerSecond);
+
+    // Blocks until the next frame is due - returns straight away when unthrottled
+    void waitForNextFrame();
+
+    // Multiple of real time to run at, clamped to MIN_SPEED..MAX_SPEED
+    void setSpeed(double multiplier);
+    double getSpeed() const { return speed.load(std::memory_order_relaxed); }
+    // Unthrottled runs as fast as the host allows
+    void setThrottled(bool enabled) { throttled.store(enabled, std::memory_order_relaxed); }
+    bool isThrottled() const { return throttled.load(std::memory_order_relaxed); }
+    // Runs unthrottled while set, without touching the throttling setting
+    void setFastForward(bool enabled) { fastForward.store(enabled, std::memory_order_relaxed); }
+    bool isFastForward() const { return fastForward.load(std::memory_order_relaxed); }
+
+    // Emulated time over real time, averaged over the last half second
+    double getMeasuredSpeed() const { return measuredSpeed.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "frame_sink.hpp"
+
+// Triple buffered frames shared between the PPU and whatever displays them
+//
+// The PPU draws into the back buffer and publishes it by swapping it with the middle
+// one. A consumer takes the newest published frame by swapping its front buffer with
+// the middle one. Neither side ever waits for the other or copies a frame - a consumer
+// that falls behind simply skips the frames it did not pick up in time
+class FrameRing {
+private:
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    // Set in middle when it holds a frame the consumer has not taken yet
+    static constexpr uint8_t NEW_FRAME = 0x4;
+
+    std::array<FrameBuffer, 3> buffers{};
+    uint8_t back{0};  // Only touched by the producer
+    uint8_t front{1}; // Only touched by the consumer
+    std::atomic<uint8_t> middle{2};
+    uint64_t framesPublished{0};
+
+public:
+    FrameRing() = default;
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+
+    // Producer side
+    FrameBuffer& getBackBuffer() { return buffers[back]; }
+    const FrameBuffer& getBackBuffer() const { return buffers[back]; }
+    // Hands the back buffer to the consumer and returns it - it stays untouched until
+    // the consumer has moved on from it, so it may be read until the next publish
+    const FrameBuffer& publish() {
+        uint8_t published = back;
+        back = middle.exchange(back | NEW_FRAME, std::memory_order_acq_rel) & INDEX_MASK;
+        framesPublished++;
+        return buffers[published];
+    }
+    uint64_t getFramesPublished() const { return framesPublished; }
+
+    // Consumer side
+    bool hasNewFrame() const { return middle.load(std::memory_order_acquire) & NEW_FRAME; }
+    // The newest published frame, valid until the next call
+    const FrameBuffer& acquireLatest() {
+        if (hasNewFrame()) {
+            front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+        return buffers[front];
+    }
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+static constexpr uint16_t SCREEN_WIDTH = 160;
+static constexpr uint16_t SCREEN_HEIGHT = 144;
+
+// RGBA32 pixels, row major
+using FrameBuffer = std::array<uint8_t, SCREEN_WIDTH * SCREEN_HEIGHT * 4>;
+
+// Receives every completed frame from the PPU when it enters V-blank - with a frame
+// skip set, only the frames that were actually drawn
+class FrameSink {
+public:
+    virtual ~FrameSink() = default;
+
+    virtual void presentFrame(const FrameBuffer& buffer) = 0;
+};
+
+// Drops frames - used when running without any video output
+class NullFrameSink: public FrameSink {
+public:
+    void presentFrame(const FrameBuffer& buffer) override {}
+};
+
+// Counts the frames it is given without displaying them
+class CountingFrameSink: public FrameSink {
+public:
+    long frames{0};
+
+    void presentFrame(const FrameBuffer& buffer) override {
+        frames++;
+    }
+};
@@ -3,16 +3,64 @@
 #include "cpu.hpp"
 #include "mmu.hpp"
 #include "cartridge.hpp"
+#include "frame_sink.hpp"
 #include "ppu.hpp"
+#include "scheduler.hpp"
 
 class Gameboy {
 private:
     Cartridge& cartridge;
+    Scheduler scheduler;
     MMU mmu;
     CPU cpu;
     PPU ppu;
 
+    // Cycle the current frame ends on
+    uint64_t frameEnd{0};
+    // Every state of a ROM has the same size, measured once on construction
+    size_t stateSize{0};
+
+    void runEvents();
+
 public:
-    explicit Gameboy(Cartridge& cartridge);
-    void run();
-};
\ No newline at end of file
+    static constexpr int CYCLES_PER_FRAME = 70224;
+    static constexpr int CLOCK_SPEED = 4194304; // Cycles per second
+    static constexpr double FRAME_RATE = static_cast<double>(CLOCK_SPEED) / CYCLES_PER_FRAME; // ~59.73 Hz
+
+    // The cartridge's clock runs on this Gameboy's cycles until it is destroyed
+    Gameboy(Cartridge& cartridge, FrameSink& frameSink);
+    ~Gameboy() { cartridge.setClock(nullptr); }
+    Gameboy(const Gameboy&) = delete;
+    Gameboy& operator=(const Gameboy&) = delete;
+
+    // Executes a single instruction and returns the cycles it took
+    int step();
+    void runFrame();
+
+    void setJitEnabled(bool enabled) { cpu.setJitEnabled(enabled); }
+    void setRenderer(PPU_RENDERER renderer) { ppu.setRenderer(renderer); }
+
+    // Fast-forward: only every n-th frame is drawn, the rest keep full timing but skip
+    // rendering. Running faster than real time is up to whoever paces the frames
+    static constexpr int DEFAULT_TURBO_FRAME_SKIP = 8;
+    void setTurbo(bool enabled, int frameSkip = DEFAULT_TURBO_FRAME_SKIP) { ppu.setFrameSkip(enabled ? frameSkip : 1); }
+    bool isTurbo() const { return ppu.getFrameSkip() > 1; }
+    uint64_t getInstructionCount() const { return cpu.getInstructionCount(); }
+
+    // Snapshot of the whole machine, appended to out. Only loads into the same ROM and
+    // throws std::runtime_error for anything else
+    static constexpr uint32_t SAVE_STATE_VERSION = 3;
+    // memoryOffset, if given, is set to where the MMU's part starts in out - see
+    // MMU::VRAM_STATE_OFFSET and takeDirtyMemoryPages
+    void saveState(std::vector<uint8_t>& out, size_t* memoryOffset = nullptr) const;
+    void loadState(const uint8_t* data, size_t size);
+    // VRAM and WRAM pages written since the last call, see MMU::takeDirtyPages
+    uint64_t takeDirtyMemoryPages() { return mmu.takeDirtyPages(); }
+
+    void handleKeyDown(uint8_t key);
+    void handleKeyUp(uint8_t key);
+
+    const std::string& getSerialOutput() const { return mmu.getSerialOutput(); }
+    FrameRing& getFrameRing() { return ppu.getFrameRing(); }
+    const std::array<uint8_t, 8192>& getWram() const { return mmu.getWram(); }
+};
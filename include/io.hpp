@@ -2,7 +2,23 @@
 
 #include <array>
 #include <cstdint>
+#include <string>
+#include <vector>
 
+#include "scheduler.hpp"
+
+// Writes to the registers that affect rendering, with the cycle they were made on.
+// Only recorded while enabled - the pixel FIFO renderer replays them dot by dot
+struct RenderRegisterLog {
+    struct Write {
+        uint64_t time;
+        uint16_t address;
+        uint8_t value;
+    };
+
+    bool enabled{false};
+    std::vector<Write> writes;
+};
 
 class IO {
 private:
@@ -10,28 +26,64 @@ private:
     static constexpr uint16_t IO_END = 0xFF7F;
     static constexpr uint16_t IO_SIZE = IO_END - IO_START + 1;
 
+    static constexpr uint16_t SB_ADDRESS = 0xFF01;
+    static constexpr uint16_t SC_ADDRESS = 0xFF02;
     static constexpr uint16_t DIV_ADDRESS = 0xFF04;
     static constexpr uint16_t TIMA_ADDRESS = 0xFF05;
     static constexpr uint16_t TMA_ADDRESS = 0xFF06;
     static constexpr uint16_t TAC_ADDRESS = 0xFF07;
+    static constexpr uint16_t LCDC_ADDRESS = 0xFF40;
+    static constexpr uint16_t SCY_ADDRESS = 0xFF42;
+    static constexpr uint16_t SCX_ADDRESS = 0xFF43;
+    static constexpr uint16_t LYC_ADDRESS = 0xFF45;
+    static constexpr uint16_t BGP_ADDRESS = 0xFF47;
+    static constexpr uint16_t OBP0_ADDRESS = 0xFF48;
+    static constexpr uint16_t OBP1_ADDRESS = 0xFF49;
+    static constexpr uint16_t WY_ADDRESS = 0xFF4A;
+    static constexpr uint16_t WX_ADDRESS = 0xFF4B;
+    static constexpr uint16_t KEY1_ADDRESS = 0xFF4D; // CGB speed switch
+
+    Scheduler& scheduler;
 
     std::array<uint8_t, 0x80> io{};
-    int divCounter{0};
-    int timaCounter{0};
+    // The timer registers are only brought up to date when they are accessed, the one
+    // thing scheduled ahead is the next TIMA overflow
+    uint64_t divResetCycle{0};
+    uint64_t lastTimaUpdate{0}; // Cycle the stored TIMA value was last brought up to
+    int timaPhase{0};           // Cycles towards the next TIMA increment at lastTimaUpdate
     uint8_t directionButtons{0xFF}; // All unpressed
     uint8_t actionButtons{0xFF};    // All unpressed
 
+    // Bytes sent over the serial port - there is no link partner so they are only recorded
+    std::string serialOutput;
+
+    RenderRegisterLog renderRegisterLog;
+    void logRenderRegisterWrite(uint16_t address, uint8_t val);
+
+    int getTimaPeriod();
+    bool isTimaEnabled();
+    // Applies the increments since the last update to the stored TIMA
+    void updateTima();
+    void scheduleTimaOverflow();
+
 public:
-    IO() : divCounter(0), timaCounter(0) {}
+    explicit IO(Scheduler& scheduler);
 
     uint8_t read(uint16_t address);
 
     void write(uint16_t address, uint8_t val);
 
-    void tick(int cycles);
+    void handleTimerEvent(uint64_t time);
     void requestInterrupt(uint8_t interrupt);
 
     void handleKeyDown(uint8_t key);
     void handleKeyUp(uint8_t key);
+
+    const std::string& getSerialOutput() const { return serialOutput; }
+    RenderRegisterLog& getRenderRegisterLog() { return renderRegisterLog; }
+
+    // The joypad buttons are the host's input and are left as they are on load
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
 };
 
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu.hpp"
+
+#ifdef GAMEBOY_JIT
+
+// x86-64 dynamic recompiler for decoded CPU blocks
+//
+// Simple register loads and 16 bit increments are translated into native code working
+// directly on the CPU's registers, everything else calls the interpreter's handler for
+// that opcode so cycle counts stay identical to the interpreter. After every handler
+// call the block exits if PC moved (a branch was taken) or the MMU saw a write outside
+// plain RAM (IO, MBC registers...), so the interpreter takes over with up to date state
+class JitCompiler {
+private:
+    static constexpr size_t CODE_BUFFER_SIZE = 1 << 20;
+    // Worst case machine code size of a single instruction
+    static constexpr size_t MAX_INSTRUCTION_CODE_SIZE = 96;
+
+    CPU& cpu;
+    uint8_t* codeBuffer{nullptr};
+    size_t codeUsed{0};
+    uint8_t* cursor{nullptr};
+    uint8_t* epilogue{nullptr};
+
+    // Offsets of the CPU state from the CPU pointer the compiled code receives
+    int32_t pcOffset;
+    int32_t spOffset;
+    int32_t instructionCountOffset;
+    int32_t registerOffsets[9];
+
+    void emit8(uint8_t value);
+    void emit16(uint16_t value);
+    void emit32(uint32_t value);
+    void emit64(uint64_t value);
+    void emitJump(uint8_t opcode, const uint8_t* target);
+    void emitJumpIfNotEqual(const uint8_t* target);
+    void emitStorePC(uint16_t value);
+    void emitEpilogue();
+
+    bool emitNative(uint8_t opcode, uint16_t operand);
+
+public:
+    explicit JitCompiler(CPU& cpu);
+    ~JitCompiler();
+    JitCompiler(const JitCompiler&) = delete;
+    JitCompiler& operator=(const JitCompiler&) = delete;
+
+    // False if executable memory could not be allocated
+    bool isAvailable() const { return codeBuffer != nullptr; }
+    // Room for another block of the given length
+    bool hasSpace(size_t numInstructions) const;
+    // Drops all compiled code - callers must forget every JitFunction they hold
+    void reset();
+
+    // Compiles the block starting at startPC, returns nullptr if there is no space left
+    JitFunction compile(uint16_t startPC, const CPU::DecodedBlock& block);
+};
+
+#endif
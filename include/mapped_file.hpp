@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A file mapped into memory - read-only and whole, or read-write and created or grown
+// to at least a given size
+//
+// Read-only mappings of the same file share the page cache's copy of it, however many
+// there are. Writes to a read-write mapping go straight to the page cache and reach the disk whenever the OS
+// writes them back, so nothing has to be flushed on exit - sync() forces it for
+// callers that want a bound on what a crash can lose. Other processes can read the
+// file while it is mapped. Without mmap (non-POSIX hosts) the file is read into memory
+// instead and written out by sync() and the destructor.
+// Throws std::runtime_error if the file can't be opened or mapped
+class MappedFile {
+private:
+    std::string path;
+    uint8_t* mapping{nullptr};
+    size_t mappedSize{0};
+    bool writable;
+#if !(defined(__unix__) || defined(__APPLE__))
+    std::vector<uint8_t> buffer;
+#endif
+
+public:
+    // Read-only, all of an existing file
+    explicit MappedFile(const std::string& path);
+    // Read-write, the first size bytes
+    MappedFile(const std::string& path, size_t size);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Only writable for read-write mappings
+    uint8_t* data() { return mapping; }
+    const uint8_t* data() const { return mapping; }
+    size_t size() const { return mappedSize; }
+    const std::string& getPath() const { return path; }
+
+    // Blocks until everything written so far is on disk. With mmap this may run on
+    // another thread than the one writing. Does nothing for read-only mappings
+    void sync();
+};
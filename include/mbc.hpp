@@ -1,9 +1,15 @@
 #pragma once
+#include <array>
 #include <cassert>
 #include <cstdint>
 #include <vector>
 #include <string>
 #include <memory>
+#include <variant>
+
+#include "save_state.hpp"
+#include "scheduler.hpp"
+#include "span.hpp"
 
 using namespace std;
 
@@ -12,31 +18,52 @@ constexpr const T& MAX(const T& a, const T& b) {
     return (a > b) ? a : b;
 }
 
-class MBC {
-public:
-    virtual ~MBC() = default;
+// Every mapper below has the same non-virtual interface, and the cartridge keeps the
+// one it needs in a Mapper variant so calls to it don't go through a vtable:
+//
+//   void write(uint16_t address, uint8_t value)   - MBC registers and external RAM
+//   uint8_t read(uint16_t address) const          - anything the MMU has no page for
+//   const uint8_t* romBank0() const               - start of the currently mapped banks
+//   const uint8_t* romBankN() const                 so the MMU can access them directly,
+//   uint8_t* ramBank()                              nullptr sends that range through
+//                                                   read/write
+//   void saveState(StateWriter&) const            - bank selection and enable state, the
+//   void loadState(StateReader&)                    RAM contents are saved by the cartridge
+//
+// The banked mappers keep the bank pointers up to date on every register write, so
+// none of these compute anything when called
 
-    virtual void write(uint16_t address, uint8_t value) = 0;
-    [[nodiscard]] virtual uint8_t read(uint16_t address) const = 0;
-};
-
-class ROMOnly: public MBC {
+class ROMOnly {
 protected:
-    vector<uint8_t>& rom;
+    Span<const uint8_t> rom;
 
 public:
-    ROMOnly(vector<uint8_t>& romData) : rom(romData) {}
+    ROMOnly() = default;
+    ROMOnly(Span<const uint8_t> romData) : rom(romData) {}
 
-    void write(uint16_t address, uint8_t value) override {
+    void write(uint16_t address, uint8_t value) {
         // ROM Only cartridges do not have MBC, so writes to ROM are ignored.
     }
 
-    [[nodiscard]] uint8_t read(uint16_t address) const override {
-        return rom.at(address);
+    [[nodiscard]] uint8_t read(uint16_t address) const {
+        return address < rom.size() ? rom[address] : 0xFF;
     }
+
+    [[nodiscard]] const uint8_t* romBank0() const {
+        return rom.size() >= 0x4000 ? rom.data() : nullptr;
+    }
+
+    [[nodiscard]] const uint8_t* romBankN() const {
+        return rom.size() >= 0x8000 ? rom.data() + 0x4000 : nullptr;
+    }
+
+    [[nodiscard]] uint8_t* ramBank() { return nullptr; }
+
+    void saveState(StateWriter& state) const {}
+    void loadState(StateReader& state) {}
 };
 
-class MBC1: public MBC {
+class MBC1 {
 protected:
     // Bank sizes
     static constexpr uint16_t ROM_BANK_SIZE = 0x4000;
@@ -61,10 +88,10 @@ protected:
     static constexpr uint16_t RAM_BANK_END       = 0xBFFF;
 
     // Cartridge data
-    vector<uint8_t>& rom;
-    vector<uint8_t>& ram;
-    const uint8_t numRomBanks;
-    const uint8_t numRamBanks;
+    Span<const uint8_t> rom;
+    Span<uint8_t> ram;
+    const uint16_t numRomBanks;
+    const uint16_t numRamBanks;
 
     // Mode and bank state
     bool ramEnabled{false};
@@ -72,36 +99,52 @@ protected:
     uint8_t romBankNumber{1};
     uint8_t ramBankNumber{0};
 
+    // Where the selected banks start, nullptr if nothing is mapped there
+    const uint8_t* romBankNStart{nullptr};
+    uint8_t* ramBankStart{nullptr};
+
     static constexpr bool inRange(uint16_t address, uint16_t start, uint16_t end) {
         return address >= start && address <= end;
     }
 
+    // Bank numbers past the end of the cartridge wrap around, the upper bits aren't wired
+    void updateBanks() {
+        size_t bankIndex = ramBankingMode ? (romBankNumber & 0x1F) : romBankNumber;
+        romBankNStart = numRomBanks > 1 ? rom.data() + (bankIndex % numRomBanks) * ROM_BANK_SIZE : nullptr;
+
+        size_t ramBankIndex = ramBankingMode ? ramBankNumber : 0;
+        ramBankStart = (ramEnabled && numRamBanks > 0) ?
+            ram.data() + (ramBankIndex % numRamBanks) * RAM_BANK_SIZE : nullptr;
+    }
+
 public:
     MBC1() = delete;
     MBC1(const MBC1&) = delete;
     MBC1& operator=(const MBC1&) = delete;
-    MBC1(MBC1&&) = delete;
-    virtual ~MBC1() = default;
+    // Moved along with its cartridge, whose ROM and RAM storage stays where it is
+    MBC1(MBC1&&) = default;
+    ~MBC1() = default;
 
-    MBC1(vector<uint8_t>& romData, vector<uint8_t>& ramData):
+    MBC1(Span<const uint8_t> romData, Span<uint8_t> ramData):
         rom(romData),
         ram(ramData),
-        numRomBanks(static_cast<uint8_t>(romData.size() / ROM_BANK_SIZE)),
-        numRamBanks(static_cast<uint8_t>(ramData.size() / RAM_BANK_SIZE)) {
+        numRomBanks(static_cast<uint16_t>(romData.size() / ROM_BANK_SIZE)),
+        numRamBanks(static_cast<uint16_t>(ramData.size() / RAM_BANK_SIZE)) {
+        updateBanks();
     }
 
-    void write(uint16_t address, uint8_t value) override
+    void write(uint16_t address, uint8_t value)
     {
-        if (inRange(address, RAM_ENABLE_START, RAM_ENABLE_END)) 
+        if (inRange(address, RAM_ENABLE_START, RAM_ENABLE_END))
         {
-            // Enable ram if 0xA is written to 0x0000 - 0x1FFF 
+            // Enable ram if 0xA is written to 0x0000 - 0x1FFF
             ramEnabled = ((value & 0xF) == 0xA);
-        } 
+        }
         else if (inRange(address, ROM_LOWER_START, ROM_LOWER_END))
         {
             // Set lower bits for rom bank
             romBankNumber = (romBankNumber & 0x60) | MAX(value & 0x1F, 1);
-        } 
+        }
         else if (inRange(address, ROM_UPPER_START, ROM_UPPER_END))
         {
             // Set upper bits of rom bank or set ram bank (depends on mode)
@@ -112,49 +155,72 @@ public:
                 uint8_t newUpperRomBankBits = (value & 0x3);
                 romBankNumber = (newUpperRomBankBits << 5) | lowerRomBankBits;
             }
-        } 
+        }
         else if (inRange(address, MODE_SELECT_START, MODE_SELECT_END))
         {
             // Set ram banking mode
             ramBankingMode = static_cast<bool>(value & 0x1);
-        } 
-        else if (ramEnabled && inRange(address, RAM_BANK_START, RAM_BANK_END)) 
+        }
+        else if (inRange(address, RAM_BANK_START, RAM_BANK_END))
         {
-            uint16_t bankOffset = (ramBankingMode ? ramBankNumber : 0) * RAM_BANK_SIZE;
-            ram.at((address - RAM_BANK_START) + bankOffset) = value;
+            // Writes while RAM is disabled are dropped
+            if (ramBankStart) {
+                ramBankStart[address - RAM_BANK_START] = value;
+            }
+            return;
         }
         else
         {
             assert(false && "MBC should not be handling address for writes");
         }
+        updateBanks();
     }
 
-    [[nodiscard]] uint8_t read(uint16_t address) const override
+    [[nodiscard]] uint8_t read(uint16_t address) const
     {
-        if (inRange(address, ROM_BANK_0_START, ROM_BANK_0_END)) 
+        if (inRange(address, ROM_BANK_0_START, ROM_BANK_0_END))
         {
-            return rom.at(address);
-        } 
+            return address < rom.size() ? rom[address] : 0xFF;
+        }
         else if (inRange(address, ROM_BANK_N_START, ROM_BANK_N_END))
         {
-            // Need to mask out the top 2 bits if ramBanking mode is on
-            uint16_t bankIndex = ramBankingMode ? (romBankNumber & 0x1F): (romBankNumber);
-            return rom.at(address + (ROM_BANK_SIZE * (bankIndex - 1)));
-        } 
-        else if (ramEnabled && inRange(address, RAM_BANK_START, RAM_BANK_END)) 
+            return romBankNStart ? romBankNStart[address - ROM_BANK_N_START] : 0xFF;
+        }
+        else if (inRange(address, RAM_BANK_START, RAM_BANK_END))
         {
-            // No offset if ram banking mode is not turned on
-            uint16_t bankOffset = ramBankingMode ? (RAM_BANK_SIZE * ramBankNumber) : 0;
-            return ram.at((address - RAM_BANK_START) + bankOffset);
-        } 
-        else 
+            return ramBankStart ? ramBankStart[address - RAM_BANK_START] : 0xFF;
+        }
+        else
         {
             return 0xFF;
         }
     }
+
+    [[nodiscard]] const uint8_t* romBank0() const
+    {
+        return rom.size() >= ROM_BANK_SIZE ? rom.data() : nullptr;
+    }
+
+    [[nodiscard]] const uint8_t* romBankN() const { return romBankNStart; }
+    [[nodiscard]] uint8_t* ramBank() { return ramBankStart; }
+
+    void saveState(StateWriter& state) const {
+        state.write(ramEnabled);
+        state.write(ramBankingMode);
+        state.write(romBankNumber);
+        state.write(ramBankNumber);
+    }
+
+    void loadState(StateReader& state) {
+        state.read(ramEnabled);
+        state.read(ramBankingMode);
+        state.read(romBankNumber);
+        state.read(ramBankNumber);
+        updateBanks();
+    }
 };
 
-class MBC2: public MBC {
+class MBC2 {
 protected:
     // Bank sizes
     static constexpr uint16_t ROM_BANK_SIZE = 0x4000;
@@ -166,41 +232,49 @@ protected:
     static constexpr uint16_t ROM_BANK_SELECT_START = 0x2000;
     static constexpr uint16_t ROM_BANK_SELECT_END = 0x3FFF;
 
-    // ROM and RAM addresses
+    // ROM and RAM addresses. The 512 bytes of RAM repeat through the whole RAM range
     static constexpr uint16_t ROM_BANK_0_START = 0x0000;
     static constexpr uint16_t ROM_BANK_0_END = 0x3FFF;
     static constexpr uint16_t ROM_BANK_N_START = 0x4000;
     static constexpr uint16_t ROM_BANK_N_END = 0x7FFF;
     static constexpr uint16_t RAM_BANK_START = 0xA000;
-    static constexpr uint16_t RAM_BANK_END = 0xA1FF;
+    static constexpr uint16_t RAM_BANK_END = 0xBFFF;
 
     // Cartridge data
-    vector<uint8_t>& rom;
-    vector<uint8_t>& ram;
-    const uint8_t numRomBanks;
+    Span<const uint8_t> rom;
+    Span<uint8_t> ram;
+    const uint16_t numRomBanks;
 
     // Mode and bank state
     bool ramEnabled{false};
     uint8_t romBankNumber{1};
 
+    const uint8_t* romBankNStart{nullptr};
+
     static constexpr bool inRange(uint16_t address, uint16_t start, uint16_t end) {
         return address >= start && address <= end;
     }
 
+    void updateBanks() {
+        romBankNStart = numRomBanks > 1 ? rom.data() + (romBankNumber % numRomBanks) * ROM_BANK_SIZE : nullptr;
+    }
+
 public:
     MBC2() = delete;
     MBC2(const MBC2&) = delete;
     MBC2& operator=(const MBC2&) = delete;
-    MBC2(MBC2&&) = delete;
-    virtual ~MBC2() = default;
+    // Moved along with its cartridge, whose ROM and RAM storage stays where it is
+    MBC2(MBC2&&) = default;
+    ~MBC2() = default;
 
-    MBC2(vector<uint8_t>& romData, vector<uint8_t>& ramData) :
+    MBC2(Span<const uint8_t> romData, Span<uint8_t> ramData) :
         rom(romData),
         ram(ramData),
-        numRomBanks(static_cast<uint8_t>(romData.size() / ROM_BANK_SIZE)) {
+        numRomBanks(static_cast<uint16_t>(romData.size() / ROM_BANK_SIZE)) {
+        updateBanks();
     }
 
-    void write(uint16_t address, uint8_t value) override {
+    void write(uint16_t address, uint8_t value) {
         if (inRange(address, RAM_ENABLE_START, RAM_ENABLE_END)) {
             if (!((address >> 8) & 0x1)) { // Check if bit 8 is 0
                 ramEnabled = ((value & 0xF) == 0xA);
@@ -208,23 +282,276 @@ public:
         } else if (inRange(address, ROM_BANK_SELECT_START, ROM_BANK_SELECT_END)) {
             if (((address >> 8) & 0x1)) { // Check if bit 8 is 1
                 romBankNumber = MAX(value & 0xF, 1);
+                updateBanks();
             }
-        } else if (ramEnabled && inRange(address, RAM_BANK_START, RAM_BANK_END)) {
-            ram.at(address - RAM_BANK_START) = value & 0xF; // MBC2 RAM is 4 bits wide
-        } else {
+        } else if (inRange(address, RAM_BANK_START, RAM_BANK_END)) {
+            if (ramEnabled) {
+                ram.at((address - RAM_BANK_START) % RAM_SIZE) = value & 0xF; // MBC2 RAM is 4 bits wide
+            }
+        } else if (!inRange(address, ROM_BANK_N_START, ROM_BANK_N_END)) {
             assert(false && "MBC2 should not be handling address for writes");
         }
     }
 
-    [[nodiscard]] uint8_t read(uint16_t address) const override {
+    [[nodiscard]] uint8_t read(uint16_t address) const {
         if (inRange(address, ROM_BANK_0_START, ROM_BANK_0_END)) {
-            return rom.at(address);
+            return address < rom.size() ? rom[address] : 0xFF;
         } else if (inRange(address, ROM_BANK_N_START, ROM_BANK_N_END)) {
-            return rom.at(address + (ROM_BANK_SIZE * (romBankNumber - 1)));
+            return romBankNStart ? romBankNStart[address - ROM_BANK_N_START] : 0xFF;
         } else if (ramEnabled && inRange(address, RAM_BANK_START, RAM_BANK_END)) {
-            return ram.at(address - RAM_BANK_START) | 0xF0; // Upper 4 bits are always 1
+            return ram.at((address - RAM_BANK_START) % RAM_SIZE) | 0xF0; // Upper 4 bits are always 1
         } else {
             return 0xFF;
         }
     }
-};
\ No newline at end of file
+
+    [[nodiscard]] const uint8_t* romBank0() const {
+        return rom.size() >= ROM_BANK_SIZE ? rom.data() : nullptr;
+    }
+
+    [[nodiscard]] const uint8_t* romBankN() const { return romBankNStart; }
+    // The RAM is 4 bits wide, so it can't be mapped directly
+    [[nodiscard]] uint8_t* ramBank() { return nullptr; }
+
+    void saveState(StateWriter& state) const {
+        state.write(ramEnabled);
+        state.write(romBankNumber);
+    }
+
+    void loadState(StateReader& state) {
+        state.read(ramEnabled);
+        state.read(romBankNumber);
+        updateBanks();
+    }
+};
+
+class MBC3 {
+public:
+    // Battery saves of cartridges with a clock end in this after the RAM: the current
+    // and latched registers as five little-endian uint32 each, then the host time as a
+    // little-endian uint64 UNIX timestamp - the layout BGB and VBA-M use
+    static constexpr size_t RTC_FOOTER_SIZE = 48;
+
+protected:
+    static constexpr uint16_t ROM_BANK_SIZE = 0x4000;
+    static constexpr uint16_t RAM_BANK_SIZE = 0x2000;
+
+    // Addresses that modify the MBC state
+    static constexpr uint16_t RAM_ENABLE_START = 0x0000;
+    static constexpr uint16_t RAM_ENABLE_END = 0x1FFF;
+    static constexpr uint16_t ROM_BANK_SELECT_START = 0x2000;
+    static constexpr uint16_t ROM_BANK_SELECT_END = 0x3FFF;
+    static constexpr uint16_t RAM_BANK_SELECT_START = 0x4000;
+    static constexpr uint16_t RAM_BANK_SELECT_END = 0x5FFF;
+    static constexpr uint16_t LATCH_CLOCK_START = 0x6000;
+    static constexpr uint16_t LATCH_CLOCK_END = 0x7FFF;
+
+    static constexpr uint16_t ROM_BANK_0_END = 0x3FFF;
+    static constexpr uint16_t ROM_BANK_N_START = 0x4000;
+    static constexpr uint16_t ROM_BANK_N_END = 0x7FFF;
+    static constexpr uint16_t RAM_BANK_START = 0xA000;
+    static constexpr uint16_t RAM_BANK_END = 0xBFFF;
+
+    // Writing 0x08-0x0C to the RAM bank select maps a clock register instead of RAM
+    static constexpr uint8_t RTC_REGISTER_FIRST = 0x08;
+    static constexpr uint8_t RTC_REGISTER_LAST = 0x0C;
+    enum RtcRegister { RTC_SECONDS, RTC_MINUTES, RTC_HOURS, RTC_DAY_LOW, RTC_DAY_HIGH, RTC_REGISTER_COUNT };
+    static constexpr uint8_t DAY_HIGH_BIT = 0x01;
+    static constexpr uint8_t HALT_BIT = 0x40;
+    static constexpr uint8_t DAY_CARRY_BIT = 0x80;
+
+    // The clock counts emulated cycles, so it keeps pace with the rest of the machine
+    // under fast-forward and speed changes and repeats exactly in scripted runs. Only
+    // the time spent with the emulator closed comes from the host clock
+    static constexpr uint64_t CYCLES_PER_SECOND = 4194304;
+
+    Span<const uint8_t> rom;
+    Span<uint8_t> ram;
+    Span<uint8_t> rtcFooter; // Empty without a save file
+    const Scheduler* clock{nullptr};
+    const uint16_t numRomBanks;
+    const uint16_t numRamBanks;
+
+    bool ramEnabled{false};
+    uint8_t romBankNumber{1};
+    uint8_t ramBankSelect{0};
+    uint8_t lastLatchWrite{0xFF};
+
+    // Clock time in cycles as of rtcBaseCycle, and the registers as last latched
+    uint64_t rtcCycles{0};
+    uint64_t rtcBaseCycle{0};
+    bool rtcHalted{false};
+    bool dayCarry{false};
+    std::array<uint8_t, RTC_REGISTER_COUNT> latchedRtc{};
+
+    const uint8_t* romBankNStart{nullptr};
+    uint8_t* ramBankStart{nullptr};
+
+    static constexpr bool inRange(uint16_t address, uint16_t start, uint16_t end) {
+        return address >= start && address <= end;
+    }
+
+    void updateBanks() {
+        romBankNStart = numRomBanks > 1 ? rom.data() + (romBankNumber % numRomBanks) * ROM_BANK_SIZE : nullptr;
+        ramBankStart = (ramEnabled && ramBankSelect < RTC_REGISTER_FIRST && numRamBanks > 0) ?
+            ram.data() + (ramBankSelect % numRamBanks) * RAM_BANK_SIZE : nullptr;
+    }
+
+    uint64_t getCycle() const { return clock ? clock->getCurrentCycle() : 0; }
+    // The clock registers right now. Folds day counter overflow into the carry flag
+    std::array<uint8_t, RTC_REGISTER_COUNT> readClock();
+    void setClockTime(const std::array<uint8_t, RTC_REGISTER_COUNT>& registers, uint64_t subSecondCycles);
+    void writeClockRegister(uint8_t index, uint8_t value);
+    // Stores the clock in the save file footer, or restores it and catches up on the
+    // host time that passed since
+    void writeFooter();
+    void readFooter();
+
+public:
+    MBC3() = delete;
+    MBC3(const MBC3&) = delete;
+    MBC3& operator=(const MBC3&) = delete;
+    // Moved along with its cartridge, whose ROM and RAM storage stays where it is
+    MBC3(MBC3&&) = default;
+    ~MBC3() = default;
+
+    // clock may be null until a Gameboy sets it, the clock stands still until then
+    MBC3(Span<const uint8_t> romData, Span<uint8_t> ramData, Span<uint8_t> rtcFooterData, const Scheduler* clock) :
+        rom(romData),
+        ram(ramData),
+        rtcFooter(rtcFooterData),
+        clock(clock),
+        numRomBanks(static_cast<uint16_t>(romData.size() / ROM_BANK_SIZE)),
+        numRamBanks(static_cast<uint16_t>(ramData.size() / RAM_BANK_SIZE)) {
+        readFooter();
+        updateBanks();
+    }
+
+    void setClockSource(const Scheduler* scheduler);
+
+    void write(uint16_t address, uint8_t value);
+    [[nodiscard]] uint8_t read(uint16_t address) const;
+
+    [[nodiscard]] const uint8_t* romBank0() const {
+        return rom.size() >= ROM_BANK_SIZE ? rom.data() : nullptr;
+    }
+    [[nodiscard]] const uint8_t* romBankN() const { return romBankNStart; }
+    // Nothing is mapped while a clock register is selected, so reads reach read()
+    [[nodiscard]] uint8_t* ramBank() { return ramBankStart; }
+
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+};
+
+class MBC5 {
+protected:
+    static constexpr uint16_t ROM_BANK_SIZE = 0x4000;
+    static constexpr uint16_t RAM_BANK_SIZE = 0x2000;
+
+    // Addresses that modify the MBC state
+    static constexpr uint16_t RAM_ENABLE_START = 0x0000;
+    static constexpr uint16_t RAM_ENABLE_END = 0x1FFF;
+    static constexpr uint16_t ROM_LOWER_START = 0x2000;
+    static constexpr uint16_t ROM_LOWER_END = 0x2FFF;
+    static constexpr uint16_t ROM_UPPER_START = 0x3000;
+    static constexpr uint16_t ROM_UPPER_END = 0x3FFF;
+    static constexpr uint16_t RAM_BANK_SELECT_START = 0x4000;
+    static constexpr uint16_t RAM_BANK_SELECT_END = 0x5FFF;
+
+    static constexpr uint16_t ROM_BANK_0_END = 0x3FFF;
+    static constexpr uint16_t ROM_BANK_N_START = 0x4000;
+    static constexpr uint16_t ROM_BANK_N_END = 0x7FFF;
+    static constexpr uint16_t RAM_BANK_START = 0xA000;
+    static constexpr uint16_t RAM_BANK_END = 0xBFFF;
+
+    Span<const uint8_t> rom;
+    Span<uint8_t> ram;
+    // Up to 512 ROM banks (8 MB) and 16 RAM banks (128 KB)
+    const uint16_t numRomBanks;
+    const uint16_t numRamBanks;
+
+    bool ramEnabled{false};
+    uint16_t romBankNumber{1}; // 9 bits, and unlike the other MBCs bank 0 can be selected
+    uint8_t ramBankNumber{0};
+
+    const uint8_t* romBankNStart{nullptr};
+    uint8_t* ramBankStart{nullptr};
+
+    static constexpr bool inRange(uint16_t address, uint16_t start, uint16_t end) {
+        return address >= start && address <= end;
+    }
+
+    void updateBanks() {
+        romBankNStart = numRomBanks > 0 ? rom.data() + (romBankNumber % numRomBanks) * ROM_BANK_SIZE : nullptr;
+        ramBankStart = (ramEnabled && numRamBanks > 0) ?
+            ram.data() + (ramBankNumber % numRamBanks) * RAM_BANK_SIZE : nullptr;
+    }
+
+public:
+    MBC5() = delete;
+    MBC5(const MBC5&) = delete;
+    MBC5& operator=(const MBC5&) = delete;
+    // Moved along with its cartridge, whose ROM and RAM storage stays where it is
+    MBC5(MBC5&&) = default;
+    ~MBC5() = default;
+
+    MBC5(Span<const uint8_t> romData, Span<uint8_t> ramData) :
+        rom(romData),
+        ram(ramData),
+        numRomBanks(static_cast<uint16_t>(romData.size() / ROM_BANK_SIZE)),
+        numRamBanks(static_cast<uint16_t>(ramData.size() / RAM_BANK_SIZE)) {
+        updateBanks();
+    }
+
+    void write(uint16_t address, uint8_t value) {
+        if (inRange(address, RAM_ENABLE_START, RAM_ENABLE_END)) {
+            ramEnabled = (value == 0x0A);
+        } else if (inRange(address, ROM_LOWER_START, ROM_LOWER_END)) {
+            romBankNumber = (romBankNumber & 0x100) | value;
+        } else if (inRange(address, ROM_UPPER_START, ROM_UPPER_END)) {
+            romBankNumber = static_cast<uint16_t>(((value & 0x1) << 8) | (romBankNumber & 0xFF));
+        } else if (inRange(address, RAM_BANK_SELECT_START, RAM_BANK_SELECT_END)) {
+            ramBankNumber = value & 0x0F;
+        } else if (inRange(address, RAM_BANK_START, RAM_BANK_END)) {
+            if (ramBankStart) {
+                ramBankStart[address - RAM_BANK_START] = value;
+            }
+            return;
+        } else {
+            return; // 0x6000-0x7FFF does nothing on MBC5
+        }
+        updateBanks();
+    }
+
+    [[nodiscard]] uint8_t read(uint16_t address) const {
+        if (address <= ROM_BANK_0_END) {
+            return address < rom.size() ? rom[address] : 0xFF;
+        } else if (inRange(address, ROM_BANK_N_START, ROM_BANK_N_END)) {
+            return romBankNStart ? romBankNStart[address - ROM_BANK_N_START] : 0xFF;
+        } else if (inRange(address, RAM_BANK_START, RAM_BANK_END)) {
+            return ramBankStart ? ramBankStart[address - RAM_BANK_START] : 0xFF;
+        }
+        return 0xFF;
+    }
+
+    [[nodiscard]] const uint8_t* romBank0() const {
+        return rom.size() >= ROM_BANK_SIZE ? rom.data() : nullptr;
+    }
+    [[nodiscard]] const uint8_t* romBankN() const { return romBankNStart; }
+    [[nodiscard]] uint8_t* ramBank() { return ramBankStart; }
+
+    void saveState(StateWriter& state) const {
+        state.write(ramEnabled);
+        state.write(romBankNumber);
+        state.write(ramBankNumber);
+    }
+
+    void loadState(StateReader& state) {
+        state.read(ramEnabled);
+        state.read(romBankNumber);
+        state.read(ramBankNumber);
+        updateBanks();
+    }
+};
+
+using Mapper = std::variant<ROMOnly, MBC1, MBC2, MBC3, MBC5>;
@@ -5,6 +5,7 @@
 #include <stdexcept>
 #include "cartridge.hpp"
 #include "io.hpp"
+#include "scheduler.hpp"
 
 enum class MemoryRegion : uint8_t {
     ROM_0,
@@ -27,10 +28,12 @@ namespace MemoryMap {
     constexpr uint16_t ROM_N_END          = 0x7FFF;
     constexpr uint16_t VRAM_START         = 0x8000;
     constexpr uint16_t VRAM_END           = 0x9FFF;
+    constexpr uint16_t TILE_DATA_END      = 0x97FF;
     constexpr uint16_t ERAM_START         = 0xA000;
     constexpr uint16_t ERAM_END           = 0xBFFF;
     constexpr uint16_t WRAM_START         = 0xC000;
     constexpr uint16_t WRAM_END           = 0xDFFF;
+    constexpr uint16_t ECHO_START         = 0xE000;
     constexpr uint16_t OAM_START          = 0xFE00;
     constexpr uint16_t OAM_END            = 0xFE9F;
     constexpr uint16_t UNUSABLE_START     = 0xFEA0;
@@ -42,15 +45,85 @@ namespace MemoryMap {
     constexpr uint16_t INTERRUPT_REGISTER = 0xFFFF;
 } // namespace MemoryMap
 
+// Tiles in 0x8000-0x97FF written since the PPU last decoded them
+struct DirtyTiles {
+    static constexpr int NUM_TILES = 384;
+    static constexpr int TILE_BYTE_SIZE = 16;
+
+    std::array<bool, NUM_TILES> tiles;
+    bool any{true};
+
+    DirtyTiles() { markAll(); }
+
+    void markAll() {
+        tiles.fill(true);
+        any = true;
+    }
+
+    void mark(uint16_t vramOffset) {
+        tiles[vramOffset / TILE_BYTE_SIZE] = true;
+        any = true;
+    }
+};
+
+// One bit per 256 byte page of VRAM (bits 0-31) and WRAM (bits 32-63). Pages outside
+// the two have no bit, so marking a write is a table lookup and an OR with no branch
+namespace DirtyPages {
+    constexpr int PAGE_SHIFT = 8;
+    constexpr size_t PAGE_SIZE = 1 << PAGE_SHIFT;
+    constexpr int PAGES_PER_BANK = 8192 / PAGE_SIZE;
+
+    constexpr std::array<uint64_t, 0x10000 / PAGE_SIZE> buildPageBits() {
+        std::array<uint64_t, 0x10000 / PAGE_SIZE> bits{};
+        for (int i = 0; i < PAGES_PER_BANK; i++) {
+            bits[(MemoryMap::VRAM_START >> PAGE_SHIFT) + i] = 1ull << i;
+            bits[(MemoryMap::WRAM_START >> PAGE_SHIFT) + i] = 1ull << (PAGES_PER_BANK + i);
+        }
+        return bits;
+    }
+    inline constexpr std::array<uint64_t, 0x10000 / PAGE_SIZE> PAGE_BITS = buildPageBits();
+} // namespace DirtyPages
+
 class MMU {
 private:
+    // The address space is split into 256 byte pages which point straight at their
+    // backing storage. Pages without a pointer (IO, OAM, MBC registers...) go through
+    // the slow region based path instead
+    static constexpr int PAGE_SHIFT = 8;
+    static constexpr int PAGE_SIZE = 1 << PAGE_SHIFT;
+    static constexpr int NUM_PAGES = 0x10000 / PAGE_SIZE;
+
+    std::array<const uint8_t*, NUM_PAGES> readPages{};
+    std::array<uint8_t*, NUM_PAGES> writePages{};
+    // Bumped whenever the cartridge ROM pages are remapped
+    uint32_t mappingVersion{0};
+    // Banks the cartridge pages point at
+    const uint8_t* mappedRomBank0{nullptr};
+    const uint8_t* mappedRomBankN{nullptr};
+    uint8_t* mappedRamBank{nullptr};
+    // Bumped by every write that goes through the region lookup (IO, MBC registers, OAM...)
+    uint32_t writeVersion{0};
+
+    // VRAM and WRAM pages written since takeDirtyPages last cleared them, see DirtyPages
+    uint64_t dirtyPages{~0ull};
+
     Cartridge& cartridge;
+    Scheduler& scheduler;
     std::array<uint8_t, 8192> vram{}; // Using std::array and initializing with {}
     std::array<uint8_t, 8192> wram{};
     std::array<uint8_t, 0xA0> oam{}; // Size should be 0xA1 (FE9F - FE00)
     std::array<uint8_t, 0x7F> hram{}; // Size should be 0x81 (FFFE - FF80)
     IO io;
     uint8_t interruptRegister{0};
+    DirtyTiles dirtyTiles;
+
+    // Writing a source page to 0xFF46 copies 160 bytes from it into OAM. The copy is
+    // done at once, the OAM then stays locked to the CPU for as long as the transfer
+    // takes on hardware
+    static constexpr uint16_t OAM_DMA_ADDRESS = 0xFF46;
+    static constexpr int OAM_DMA_CYCLES = 640; // 160 M-cycles
+    bool oamDmaActive{false};
+    void startOamDma(uint8_t sourcePage);
 
     static constexpr bool inRange(uint16_t address, uint16_t start, uint16_t end) {
         return address >= start && address <= end;
@@ -83,18 +156,87 @@ private:
         }
     }
 
+    void mapPages(uint16_t start, uint16_t end, const uint8_t* readBase, uint8_t* writeBase);
+    // Read side only, for the ROM - its write pages stay empty
+    void mapReadPages(uint16_t start, uint16_t end, const uint8_t* base);
+    // Points the ROM and external RAM pages at the banks currently selected by the MBC
+    void remapCartridge();
+
+    uint8_t readUnmapped(uint16_t address);
+    void writeUnmapped(uint16_t address, uint8_t value);
+
 public:
     // Constructor uses initializer list for mbc, consistent with good practice
-    explicit MMU(Cartridge& cartridge);
-
-    void tick(int cycles);
+    MMU(Cartridge& cartridge, Scheduler& scheduler);
 
     void requestInterrupt(uint8_t interrupt);
 
-    uint8_t read(uint16_t address);
+    uint8_t read(uint16_t address) {
+        const uint8_t* page = readPages[address >> PAGE_SHIFT];
+        if (page) {
+            return page[address & (PAGE_SIZE - 1)];
+        }
+        return readUnmapped(address);
+    }
+
+    void write(uint16_t address, uint8_t value) {
+        uint8_t* page = writePages[address >> PAGE_SHIFT];
+        if (page) {
+            page[address & (PAGE_SIZE - 1)] = value;
+            dirtyPages |= DirtyPages::PAGE_BITS[address >> PAGE_SHIFT];
+            return;
+        }
+        writeUnmapped(address, value);
+    }
+
+    // Direct pointer to the backing storage of a ROM address, or nullptr if it is unmapped
+    const uint8_t* getRomPointer(uint16_t address) const {
+        if (address > MemoryMap::ROM_N_END) {
+            return nullptr;
+        }
+        const uint8_t* page = readPages[address >> PAGE_SHIFT];
+        return page ? page + (address & (PAGE_SIZE - 1)) : nullptr;
+    }
 
-    void write(uint16_t address, uint8_t value);
+    // Raw VRAM and OAM for the PPU, which reads them far too often to go through read()
+    const std::array<uint8_t, 8192>& getVram() const { return vram; }
+    const std::array<uint8_t, 0xA0>& getOam() const { return oam; }
+    const std::array<uint8_t, 8192>& getWram() const { return wram; }
+    // The PPU clears these as it decodes the tiles again
+    DirtyTiles& getDirtyTiles() { return dirtyTiles; }
+    RenderRegisterLog& getRenderRegisterLog() { return io.getRenderRegisterLog(); }
+
+    Scheduler& getScheduler() { return scheduler; }
+    uint32_t getMappingVersion() const { return mappingVersion; }
+    const uint32_t* getWriteVersionPointer() const { return &writeVersion; }
+
+    // Full memory region dispatch without the page table
+    // Kept as the fallback for unmapped pages and as the baseline for benchmarks
+    uint8_t readRegion(uint16_t address);
+    void writeRegion(uint16_t address, uint8_t value);
+
+    void handleTimerEvent(uint64_t time) { io.handleTimerEvent(time); }
+    void handleOamDmaEvent() { oamDmaActive = false; }
+
+    // VRAM and WRAM pages written since the last call, as a DirtyPages mask. Loading a
+    // state marks them all
+    uint64_t takeDirtyPages() {
+        uint64_t pages = dirtyPages;
+        dirtyPages = 0;
+        return pages;
+    }
+
+    // Where VRAM and WRAM start in what saveState writes
+    static constexpr size_t VRAM_STATE_OFFSET = 0;
+    static constexpr size_t WRAM_STATE_OFFSET = 8192;
+
+    // Memory and IO registers. Loading remaps the cartridge banks, so the cartridge has
+    // to be loaded first, and marks every tile dirty for the PPU
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
 
     void handleKeyDown(uint8_t key);
     void handleKeyUp(uint8_t key);
+
+    const std::string& getSerialOutput() const { return io.getSerialOutput(); }
 };
\ No newline at end of file
@@ -1,26 +1,12 @@
 #pragma once
+#include <algorithm>
 #include <cstdint>
 #include <array>
-#include <SDL2/SDL.h>
 
+#include "frame_ring.hpp"
+#include "frame_sink.hpp"
 #include "mmu.hpp"
-
-static constexpr uint16_t SCREEN_WIDTH = 160;
-static constexpr uint16_t SCREEN_HEIGHT = 144;
-
-
-class Display {
-private:
-    SDL_Window* window;
-    SDL_Renderer* renderer;
-    SDL_Texture* texture;
-
-public:
-    Display();
-    ~Display();
-
-    void redraw(const std::array<uint8_t, SCREEN_WIDTH * SCREEN_HEIGHT * 4>& buffer);
-};
+#include "scheduler.hpp"
 
 enum class PPU_MODE {
     HBLANK,
@@ -29,11 +15,27 @@ enum class PPU_MODE {
     PIXEL_TRANSFER
 };
 
+// How pixel transfer turns VRAM into pixels. SCANLINE draws the whole line in one go
+// at the end of mode 3, PIXEL_FIFO steps through it dot by dot so register writes in
+// the middle of a line take effect from the pixel they land on
+enum class PPU_RENDERER {
+    SCANLINE,
+    PIXEL_FIFO
+};
+
 class PPU {
 private:
     PPU_MODE currentMode{PPU_MODE::OAM_SCAN};
     static constexpr int DOTS_PER_SCANLINE = 456;
     static constexpr int SCANLINES_PER_FRAME = 154;
+    static constexpr int OAM_SCAN_DOTS = 80;
+    // Pixel transfer takes at least this long, extended by SCX scrolling, the window
+    // and sprite fetches. H-blank gets whatever is left of the line
+    static constexpr int PIXEL_TRANSFER_DOTS = 172;
+    static constexpr int FETCHER_STARTUP_DOTS = PIXEL_TRANSFER_DOTS - SCREEN_WIDTH;
+    static constexpr int WINDOW_FETCH_DOTS = 6;
+    static constexpr int SPRITE_FETCH_DOTS = 6;
+    static constexpr int OFFSCREEN_SPRITE_DOTS = 11;
 
     static constexpr uint16_t LCDC_ADDRESS = 0xFF40;
     static constexpr uint16_t STAT_ADDRESS = 0xFF41;
@@ -44,8 +46,8 @@ private:
     static constexpr uint16_t BGP_ADDRESS = 0xFF47;
     static constexpr uint16_t OBP0_ADDRESS = 0xFF48;
     static constexpr uint16_t OBP1_ADDRESS = 0xFF49;
-    static constexpr uint16_t WX_ADDRESS = 0xFF4A;
-    static constexpr uint16_t WY_ADDRESS = 0xFF4B;
+    static constexpr uint16_t WY_ADDRESS = 0xFF4A;
+    static constexpr uint16_t WX_ADDRESS = 0xFF4B;
 
     static constexpr uint16_t SCREEN_SIZE = SCREEN_WIDTH * SCREEN_HEIGHT;
 
@@ -66,20 +68,155 @@ private:
     static constexpr uint8_t NUM_TILES_PER_COLUMN = 32;
     static constexpr uint8_t NUM_TILES_PER_ROW = 32;
 
-    std::array<uint8_t, SCREEN_SIZE * 4> frameBuffer{};
+    // RGBA value of each shade, darkest first
+    static constexpr std::array<std::array<uint8_t, 4>, 4> SHADES = {{
+        {0, 0, 0, 255}, // black
+        {96, 96, 96, 255},
+        {192, 192, 192, 255},
+        {255, 255, 255, 255},
+    }};
+    using Palette = std::array<std::array<uint8_t, 4>, 4>;
+
+    // Registers the renderer needs, read once per scanline (or kept current dot by dot
+    // by the pixel FIFO)
+    struct LineRegisters {
+        uint8_t lcdc;
+        uint8_t scx;
+        uint8_t scy;
+        uint8_t ly;
+        uint8_t wx;
+        uint8_t wy;
+        Palette bgp;
+        Palette obp0;
+        Palette obp1;
+    };
+
+    // Frames are drawn straight into the ring's back buffer
+    FrameRing frames;
     MMU& bus;
-
-    Display display;
-    int m_dots{0};
-
-    uint16_t getTileAddress(uint8_t tileNumber);
-    void setPixel(int x, int y, uint8_t value);
+    const std::array<uint8_t, 8192>& vram;
+    const std::array<uint8_t, 0xA0>& oam;
+
+    // Every tile in VRAM decoded to 8x8 color indices, row by row. Tiles are decoded
+    // again before a scanline is drawn if they were written since
+    using DecodedTile = std::array<uint8_t, TILE_PIXEL_SIZE * TILE_PIXEL_SIZE>;
+    std::array<DecodedTile, DirtyTiles::NUM_TILES> tileCache{};
+    DirtyTiles& dirtyTiles;
+
+    // Sprites on the current line, picked by the OAM scan in drawing priority order
+    static constexpr int MAX_SPRITES_PER_LINE = 10;
+    struct LineSprite {
+        int16_t x;        // Screen X of the leftmost pixel, may be off screen
+        uint8_t oamIndex;
+    };
+    std::array<LineSprite, MAX_SPRITES_PER_LINE> lineSprites{};
+    int numLineSprites{0};
+
+    // The window is drawn once WY has matched LY during the frame, and keeps its own line
+    // counter which only moves on lines it was actually drawn on
+    bool windowTriggered{false};
+    uint8_t windowLine{0};
+
+    PPU_RENDERER renderer{PPU_RENDERER::SCANLINE};
+
+    // Only every frameSkip-th frame is drawn. The others still run every mode with the
+    // same timing, they just never produce pixels
+    int frameSkip{1};
+    uint64_t frameCount{0};
+    bool drawingFrame{true};
+    // Renderer the current line started with, so switching only takes effect on the next
+    PPU_RENDERER lineRenderer{PPU_RENDERER::SCANLINE};
+    // Length of the current line's pixel transfer. While the pixel FIFO is running it is
+    // the earliest the line can still finish
+    int pixelTransferDots{PIXEL_TRANSFER_DOTS};
+
+    // State of the pixel FIFO part way through a line
+    struct PixelFifo {
+        LineRegisters registers;  // Register values as of the current dot
+        uint64_t startTime;       // Cycle pixel transfer started on
+        size_t nextWrite;         // First register write not applied yet
+        int dot;                  // Dots of pixel transfer done
+        int x;                    // Next screen X to output
+        int discard;              // Pixels of the first tile still to drop for SCX
+        int stall;                // Dots left of a window or sprite fetch
+        int fetcherX;             // Next tile map column, relative to SCX or the window
+        int lastPenalizedTile;    // Background tile that last delayed a sprite fetch
+        int nextSprite;           // Next entry of lineSprites waiting for its X
+        bool windowActive;
+        // The BG FIFO - one tile row, consumed from the left
+        std::array<uint8_t, TILE_PIXEL_SIZE> bgPixels;
+        int bgCount;
+        // The sprite FIFO merged ahead of time: per screen X the winning sprite pixel as
+        // color | palette << 2 | BG priority << 3, 0 where no sprite is opaque
+        std::array<uint8_t, SCREEN_WIDTH> spritePixels;
+    };
+    PixelFifo fifo{};
+    RenderRegisterLog& registerLog;
+
+    FrameSink& frameSink;
+    Scheduler& scheduler;
+    bool lcdEnabled{false};
+
+    static Palette decodePalette(uint8_t palette);
+    LineRegisters readLineRegisters();
+    void updateTileCache();
+    // Decoded row tileY of a background/window tile, using the LCDC addressing mode
+    const uint8_t* getTileRow(uint8_t lcdc, uint8_t tileNumber, uint8_t tileY) const;
+
+    void renderScanline(const LineRegisters& registers);
+    // Fill colors with the background/window color indices of the current line
+    void drawBackground(const LineRegisters& registers, uint8_t* colors);
+    void drawWindow(const LineRegisters& registers, uint8_t* colors);
+    void drawSprites(const LineRegisters& registers, const uint8_t* colors, uint8_t* line);
+
+    bool isWindowVisible(const LineRegisters& registers) const;
+    // Dots a sprite at screen X spriteX holds up pixel transfer for. The wait for the
+    // background fetch is only paid once per background tile, tracked in lastPenalizedTile
+    static int getSpriteFetchDots(int spriteX, uint8_t scx, int& lastPenalizedTile);
+    // How long pixel transfer takes for the current line when nothing changes during it
+    int computePixelTransferDots(const LineRegisters& registers) const;
+
+    void startPixelFifo(uint64_t time);
+    // Runs the pixel FIFO for the dots before time, returns true once the line is done
+    bool runPixelFifo(uint64_t time);
+    void applyRegisterWrite(uint16_t address, uint8_t value);
+    void fetchFifoTile();
+    void loadFifoSprite(const LineSprite& lineSprite);
+    void outputFifoPixel(uint8_t* line);
+
+    // Updates STAT for the new mode, requests its STAT interrupt and schedules its end
+    void enterMode(PPU_MODE mode, uint64_t time);
+    void setScanline(uint8_t scanline);
+    // Updates the LY == LYC flag, requesting a STAT interrupt when it becomes set
+    void compareLYC();
 
 public:
-    explicit PPU(MMU& bus);
-
-    void tick(int cycles);
+    PPU(MMU& bus, FrameSink& frameSink, Scheduler& scheduler);
+
+    // Mode transitions are driven by the scheduler rather than ticked every instruction
+    void handleModeEvent(uint64_t time);
+    void handleRegisterWrite(uint64_t time);
+
+    void setRenderer(PPU_RENDERER newRenderer);
+    PPU_RENDERER getRenderer() const { return renderer; }
+    // Draw only every n-th frame (1 draws all of them), from the next frame on
+    void setFrameSkip(int n) { frameSkip = std::max(n, 1); }
+    int getFrameSkip() const { return frameSkip; }
+
+    // Selects the sprites for the current line - the first 10 in OAM that overlap it,
+    // ordered so the lowest X (then the lowest OAM index) is drawn on top. Also latches
+    // the window's WY trigger, which is checked at the start of every line
+    void scanOAM();
+    // Draws the whole current line with the selected renderer, ignoring timing
     void drawScanline();
-    void drawSprites();
-    void drawWindow();
+
+    // Mode, line and renderer state, and the frame drawn so far. The renderer choice and
+    // frame skip are settings and stay as they are on load
+    // The sprite list and pixel FIFO are written field by field, so no struct padding
+    // ends up in states or rewind deltas
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+
+    // Completed frames, for consumers that pick them up on their own schedule
+    FrameRing& getFrameRing() { return frames; }
 };
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "gameboy.hpp"
+
+// History of save states to step the emulator back through
+//
+// Only the newest snapshot is kept whole. Every older one is stored as the XOR of it
+// with the snapshot after it, run-length encoded - consecutive frames share nearly all
+// of their state, so most of that is long runs of zeros. The VRAM and WRAM pages the
+// MMU reports unwritten are known to XOR to zero and are skipped without comparing
+// them. Once the deltas outgrow the memory budget the oldest ones are dropped
+class RewindBuffer {
+public:
+    static constexpr size_t DEFAULT_MEMORY_BUDGET = 32 << 20;
+
+private:
+    // Shorter runs of equal bytes stay inside a literal, where they cost less than
+    // ending it and starting a new one
+    static constexpr size_t MIN_ZERO_RUN = 4;
+
+    size_t memoryBudget;
+    int framesPerSnapshot;
+    int framesSinceSnapshot{0};
+
+    std::vector<uint8_t> head;
+    std::vector<uint8_t> next;
+    // Each one turns a snapshot into the one before it, oldest first. A delta is a list
+    // of (zero bytes to skip, literal count, literal bytes) with the counts as varints
+    std::deque<std::vector<uint8_t>> deltas;
+    size_t deltaBytes{0};
+
+    static void encodeDelta(const uint8_t* newer, const uint8_t* older, size_t size, size_t memoryOffset,
+                            uint64_t dirtyPages, std::vector<uint8_t>& delta);
+    static void applyDelta(const std::vector<uint8_t>& delta, std::vector<uint8_t>& state);
+
+public:
+    // Snapshots every framesPerSnapshot frames, keeping as many as fit in memoryBudget bytes
+    explicit RewindBuffer(size_t memoryBudget = DEFAULT_MEMORY_BUDGET, int framesPerSnapshot = 1);
+
+    // Call after every frame. This takes the Gameboy's dirty memory pages, so nothing
+    // else may use them
+    void captureFrame(Gameboy& emu);
+    // Loads the snapshot before the newest one and makes it the newest, false once
+    // there is nothing older left
+    bool rewind(Gameboy& emu);
+    void clear();
+
+    size_t getSnapshotCount() const { return head.empty() ? 0 : deltas.size() + 1; }
+    size_t getMemoryUsed() const { return head.size() + deltaBytes; }
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// Byte streams the emulator's components serialize themselves into for save states.
+// Values are copied in host byte order with no per-field tags - the format version in
+// the header is bumped whenever any component changes what it writes
+class StateWriter {
+private:
+    std::vector<uint8_t>& buffer;
+
+public:
+    // Appends to buffer
+    explicit StateWriter(std::vector<uint8_t>& buffer) : buffer(buffer) {}
+
+    void writeBytes(const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        buffer.insert(buffer.end(), bytes, bytes + size);
+    }
+
+    template <typename T>
+    void write(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be written directly");
+        writeBytes(&value, sizeof(T));
+    }
+};
+
+class StateReader {
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t position{0};
+
+public:
+    StateReader(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+    void readBytes(void* destination, size_t count) {
+        if (count > size - position) {
+            throw std::runtime_error("Save state is truncated");
+        }
+        std::memcpy(destination, data + position, count);
+        position += count;
+    }
+
+    template <typename T>
+    void read(T& value) {
+        static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be read directly");
+        readBytes(&value, sizeof(T));
+    }
+
+    bool atEnd() const { return position == size; }
+};
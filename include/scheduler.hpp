@@ -0,0 +1,62 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "save_state.hpp"
+
+// Everything that happens at a known point in the future. Each type has at most one
+// pending occurrence - scheduling it again replaces the earlier deadline
+enum class EventType : uint8_t {
+    PPU_MODE,           // End of the current PPU mode
+    LCD_REGISTER_WRITE, // LCDC/LYC were written and the PPU needs to react
+    TIMER,              // TIMA overflow
+    OAM_DMA,            // End of an OAM DMA transfer
+    COUNT
+};
+
+struct Event {
+    EventType type;
+    uint64_t time;
+};
+
+// Keeps the emulated clock and the deadline of every event type
+//
+// There are only a handful of event types so deadlines live in fixed slots and the
+// earliest one is cached, which keeps the per-instruction check to one comparison
+class Scheduler {
+public:
+    static constexpr uint64_t NEVER = UINT64_MAX;
+
+private:
+    static constexpr size_t NUM_EVENT_TYPES = static_cast<size_t>(EventType::COUNT);
+
+    std::array<uint64_t, NUM_EVENT_TYPES> deadlines;
+    uint64_t currentCycle{0};
+    uint64_t nextDeadline{NEVER};
+
+    void updateNextDeadline();
+
+public:
+    Scheduler();
+
+    uint64_t getCurrentCycle() const { return currentCycle; }
+    // For compiled CPU blocks, which move the clock forward to each instruction they
+    // hand to the interpreter so it sees the same time it would have without the JIT
+    uint64_t* getCurrentCyclePointer() { return &currentCycle; }
+    uint64_t getNextDeadline() const { return nextDeadline; }
+
+    void advance(int cycles) { currentCycle += cycles; }
+    bool eventDue() const { return currentCycle >= nextDeadline; }
+
+    // Schedules at an absolute cycle, or relative to the current one
+    void scheduleAt(EventType type, uint64_t time);
+    void scheduleIn(EventType type, uint64_t cycles) { scheduleAt(type, currentCycle + cycles); }
+    void cancel(EventType type);
+
+    // Removes the earliest event - only valid while eventDue()
+    Event popEvent();
+
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+};
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <stdexcept>
+
+// Non-owning view of a contiguous buffer, for memory the cartridge hands to its MBC
+// without caring whether a vector or a mapped file owns it (std::span is C++20)
+template <typename T>
+class Span {
+private:
+    T* pointer{nullptr};
+    size_t length{0};
+
+public:
+    Span() = default;
+    Span(T* data, size_t size) : pointer(data), length(size) {}
+    template <typename Container>
+    Span(Container& container) : pointer(container.data()), length(container.size()) {}
+
+    T* data() const { return pointer; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    T* begin() const { return pointer; }
+    T* end() const { return pointer + length; }
+
+    T& operator[](size_t index) const { return pointer[index]; }
+    // Bounds checked like std::vector::at
+    T& at(size_t index) const {
+        if (index >= length) {
+            throw std::out_of_range("Span index out of range");
+        }
+        return pointer[index];
+    }
+};
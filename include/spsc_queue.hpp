@@ -0,0 +1,44 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread
+//
+// Each side only writes its own index, so a push or pop is a load of the other side's
+// index and a release store of its own. Capacity must be a power of two
+template <typename T, size_t Capacity>
+class SpscQueue {
+private:
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    std::array<T, Capacity> items{};
+    // Free running counters, kept on separate cache lines so the two threads don't
+    // keep stealing the line from each other
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head{0}; // Next item to pop
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail{0}; // Next free slot
+
+public:
+    // Producer side, false if the queue is full
+    bool push(const T& item) {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        items[currentTail & (Capacity - 1)] = item;
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, false if the queue is empty
+    bool pop(T& item) {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[currentHead & (Capacity - 1)];
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+};
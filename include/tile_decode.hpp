@@ -0,0 +1,127 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+// Kernels for turning 2bpp tile rows into color indices and color indices into RGBA
+// pixels. The palette expansion is picked at compile time from the instruction sets
+// the compiler targets, with a portable scalar version when none of them are available
+// (or when built with GAMEBOY_NO_SIMD)
+#if !defined(GAMEBOY_NO_SIMD) && defined(__AVX2__)
+    #define GAMEBOY_TILE_DECODE_AVX2
+    #include <immintrin.h>
+#elif !defined(GAMEBOY_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+    #define GAMEBOY_TILE_DECODE_SSE2
+    #include <emmintrin.h>
+    #if defined(__SSSE3__)
+        #include <tmmintrin.h>
+    #endif
+#elif !defined(GAMEBOY_NO_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+    #define GAMEBOY_TILE_DECODE_NEON
+    #include <arm_neon.h>
+#endif
+
+namespace TileDecode {
+    constexpr int PIXELS_PER_ROW = 8;
+
+#if defined(GAMEBOY_TILE_DECODE_AVX2)
+    constexpr const char* IMPLEMENTATION = "AVX2";
+#elif defined(GAMEBOY_TILE_DECODE_SSE2) && defined(__SSSE3__)
+    constexpr const char* IMPLEMENTATION = "SSSE3";
+#elif defined(GAMEBOY_TILE_DECODE_SSE2)
+    constexpr const char* IMPLEMENTATION = "SSE2";
+#elif defined(GAMEBOY_TILE_DECODE_NEON)
+    constexpr const char* IMPLEMENTATION = "NEON";
+#else
+    constexpr const char* IMPLEMENTATION = "scalar";
+#endif
+
+    // Every byte value spread out to one bit per byte, most significant bit first
+    constexpr std::array<std::array<uint8_t, 8>, 256> buildSpreadTable() {
+        std::array<std::array<uint8_t, 8>, 256> table{};
+        for (int value = 0; value < 256; value++) {
+            for (int bit = 0; bit < 8; bit++) {
+                table[value][bit] = (value >> (7 - bit)) & 1;
+            }
+        }
+        return table;
+    }
+    inline constexpr std::array<std::array<uint8_t, 8>, 256> SPREAD_TABLE = buildSpreadTable();
+
+    // Color indices of the 8 pixels in one row of a tile, leftmost first.
+    // The first byte of the row holds the upper bit of each color, the second the lower.
+    // Both bytes are spread through a table and combined 8 pixels at a time in a 64 bit
+    // register - broadcasting two bytes into vector registers costs more than this on
+    // every target we measured, so there is no vector version
+    inline void decodeRow(const uint8_t* row, uint8_t* pixels) {
+        // Values are at most 1 per byte so the shift never carries into the next pixel
+        uint64_t upper;
+        uint64_t lower;
+        std::memcpy(&upper, SPREAD_TABLE[row[0]].data(), sizeof(upper));
+        std::memcpy(&lower, SPREAD_TABLE[row[1]].data(), sizeof(lower));
+        uint64_t colors = (upper << 1) | lower;
+        std::memcpy(pixels, &colors, sizeof(colors));
+    }
+
+    // Looks up count (a multiple of 8) color indices in a palette of 4 RGBA colors
+    inline void expandPixels(const uint8_t* colors, const uint8_t* palette, uint8_t* rgba, int count) {
+#if defined(GAMEBOY_TILE_DECODE_AVX2)
+        // Each color index c becomes the byte indices 4c..4c+3 of its RGBA value
+        const __m256i paletteBytes = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette)));
+        const __m256i spread = _mm256_set1_epi32(0x04040404);
+        const __m256i byteOffsets = _mm256_set1_epi32(0x03020100);
+        for (int i = 0; i < count; i += PIXELS_PER_ROW) {
+            __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(colors + i)));
+            indices = _mm256_add_epi32(_mm256_mullo_epi32(indices, spread), byteOffsets);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + i * 4), _mm256_shuffle_epi8(paletteBytes, indices));
+        }
+#elif defined(GAMEBOY_TILE_DECODE_SSE2) && defined(__SSSE3__)
+        const __m128i paletteBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette));
+        const __m128i byteOffsets = _mm_set1_epi32(0x03020100);
+        for (int i = 0; i < count; i += PIXELS_PER_ROW) {
+            __m128i indices = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(colors + i));
+            indices = _mm_slli_epi16(_mm_unpacklo_epi8(indices, indices), 2);
+            __m128i left = _mm_add_epi8(_mm_unpacklo_epi16(indices, indices), byteOffsets);
+            __m128i right = _mm_add_epi8(_mm_unpackhi_epi16(indices, indices), byteOffsets);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i * 4), _mm_shuffle_epi8(paletteBytes, left));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i * 4 + 16), _mm_shuffle_epi8(paletteBytes, right));
+        }
+#elif defined(GAMEBOY_TILE_DECODE_SSE2)
+        // No byte shuffle before SSSE3, so select each of the 4 colors with a compare
+        uint32_t paletteColors[4];
+        std::memcpy(paletteColors, palette, sizeof(paletteColors));
+        const __m128i zero = _mm_setzero_si128();
+        for (int i = 0; i < count; i += PIXELS_PER_ROW) {
+            __m128i indices = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(colors + i)), zero);
+            __m128i halves[2] = {_mm_unpacklo_epi16(indices, zero), _mm_unpackhi_epi16(indices, zero)};
+            for (int half = 0; half < 2; half++) {
+                __m128i pixels = zero;
+                for (int color = 0; color < 4; color++) {
+                    __m128i match = _mm_cmpeq_epi32(halves[half], _mm_set1_epi32(color));
+                    pixels = _mm_or_si128(pixels, _mm_and_si128(match, _mm_set1_epi32(static_cast<int>(paletteColors[color]))));
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i * 4 + half * 16), pixels);
+            }
+        }
+#elif defined(GAMEBOY_TILE_DECODE_NEON)
+        uint8x16_t paletteBytes = vld1q_u8(palette);
+        const uint8_t offsetValues[16] = {0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
+        uint8x16_t byteOffsets = vld1q_u8(offsetValues);
+        for (int i = 0; i < count; i += PIXELS_PER_ROW) {
+            uint8x8_t indices = vshl_n_u8(vld1_u8(colors + i), 2);
+            uint8x8x2_t pairs = vzip_u8(indices, indices);
+            uint16x4x2_t left = vzip_u16(vreinterpret_u16_u8(pairs.val[0]), vreinterpret_u16_u8(pairs.val[0]));
+            uint16x4x2_t right = vzip_u16(vreinterpret_u16_u8(pairs.val[1]), vreinterpret_u16_u8(pairs.val[1]));
+            uint8x16_t leftIndices = vaddq_u8(vreinterpretq_u8_u16(vcombine_u16(left.val[0], left.val[1])), byteOffsets);
+            uint8x16_t rightIndices = vaddq_u8(vreinterpretq_u8_u16(vcombine_u16(right.val[0], right.val[1])), byteOffsets);
+            vst1q_u8(rgba + i * 4, vqtbl1q_u8(paletteBytes, leftIndices));
+            vst1q_u8(rgba + i * 4 + 16, vqtbl1q_u8(paletteBytes, rightIndices));
+        }
+#else
+        for (int i = 0; i < count; i++) {
+            std::memcpy(rgba + i * 4, palette + colors[i] * 4, 4);
+        }
+#endif
+    }
+} // namespace TileDecode
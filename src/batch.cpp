@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cartridge.hpp"
+#include "frame_sink.hpp"
+#include "gameboy.hpp"
+
+namespace fs = std::filesystem;
+
+// Runs a manifest of scripted ROM sessions across all cores, one Gameboy per job.
+//
+// Manifest lines are "rom frames [input script]", paths relative to the manifest.
+// Input script lines are "frame button down|up", applied before that frame runs, with
+// buttons named right, left, up, down, a, b, select and start. '#' starts a comment
+// in both.
+//
+// Usage: ./gameboy_batch {manifest} [--threads n] [--out directory]
+// Results go to stdout as CSV (and to results.csv in the output directory, next to a
+// dump of each job's work RAM and cartridge RAM)
+
+struct ScriptEvent {
+    long frame;
+    uint8_t button;
+    bool pressed;
+};
+
+struct Job {
+    std::string rom;
+    long frames;
+    std::string script;
+};
+
+struct JobResult {
+    bool ok{false};
+    std::string error;
+    long framesPresented{0};
+    uint64_t frameHash{0};
+    uint64_t wramHash{0};
+    double seconds{0};
+};
+
+// Runs a fixed set of tasks on a number of threads. Every thread starts with its own
+// share of the tasks and works from the back of its deque, and once that runs dry it
+// steals from the front of the others' - long jobs on one thread don't leave the rest idle
+class WorkStealingPool {
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+
+    bool popLocal(size_t worker, size_t& task) {
+        WorkerQueue& queue = *queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            return false;
+        }
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t worker, size_t& task) {
+        for (size_t offset = 1; offset < queues.size(); offset++) {
+            WorkerQueue& victim = *queues[(worker + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    explicit WorkStealingPool(size_t numThreads) {
+        for (size_t i = 0; i < numThreads; i++) {
+            queues.push_back(std::make_unique<WorkerQueue>());
+        }
+    }
+
+    // Calls task(i) for every i below numTasks and returns once all of them are done.
+    // No tasks are added while running, so a thread that finds nothing left can stop
+    void run(size_t numTasks, const std::function<void(size_t)>& task) {
+        for (size_t i = 0; i < numTasks; i++) {
+            queues[i % queues.size()]->tasks.push_back(i);
+        }
+
+        std::vector<std::thread> threads;
+        for (size_t worker = 0; worker < queues.size(); worker++) {
+            threads.emplace_back([this, worker, &task]() {
+                size_t next;
+                while (popLocal(worker, next) || steal(worker, next)) {
+                    task(next);
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+};
+
+uint64_t hashBytes(const uint8_t* data, size_t size) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Strips a '#' comment, returns false if nothing is left
+bool stripComment(std::string& line) {
+    line = line.substr(0, line.find('#'));
+    return line.find_first_not_of(" \t\r") != std::string::npos;
+}
+
+int getButtonIndex(const std::string& name) {
+    static const char* const NAMES[] = {"right", "left", "up", "down", "a", "b", "select", "start"};
+    for (int i = 0; i < 8; i++) {
+        if (name == NAMES[i]) {
+            return i;
+        }
+    }
+    throw std::runtime_error("Unknown button '" + name + "'");
+}
+
+std::vector<ScriptEvent> readInputScript(const std::string& fileName) {
+    std::ifstream file(fileName);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open input script " + fileName);
+    }
+
+    std::vector<ScriptEvent> events;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!stripComment(line)) {
+            continue;
+        }
+        std::istringstream fields(line);
+        long frame;
+        std::string button;
+        std::string state;
+        if (!(fields >> frame >> button >> state) || (state != "down" && state != "up")) {
+            throw std::runtime_error("Bad input script line '" + line + "'");
+        }
+        events.push_back({frame, static_cast<uint8_t>(getButtonIndex(button)), state == "down"});
+    }
+
+    std::stable_sort(events.begin(), events.end(),
+                     [](const ScriptEvent& a, const ScriptEvent& b) { return a.frame < b.frame; });
+    return events;
+}
+
+std::vector<Job> readManifest(const std::string& fileName) {
+    std::ifstream file(fileName);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open manifest " + fileName);
+    }
+    fs::path base = fs::path(fileName).parent_path();
+
+    std::vector<Job> jobs;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!stripComment(line)) {
+            continue;
+        }
+        // ROM names may contain spaces, so the frame count is found from the right
+        std::istringstream fields(line);
+        std::vector<std::string> words;
+        std::string word;
+        while (fields >> word) {
+            words.push_back(word);
+        }
+
+        Job job;
+        size_t framesField = words.size() - 1;
+        auto isNumber = [](const std::string& text) {
+            return text.find_first_not_of("0123456789") == std::string::npos;
+        };
+        if (!isNumber(words[framesField]) && words.size() >= 3 && isNumber(words[framesField - 1])) {
+            framesField--;
+            job.script = (base / words.back()).string();
+        }
+        if (framesField == 0 || !isNumber(words[framesField])) {
+            throw std::runtime_error("Bad manifest line '" + line + "'");
+        }
+
+        std::string rom = words[0];
+        for (size_t i = 1; i < framesField; i++) {
+            rom += " " + words[i];
+        }
+        job.rom = (base / rom).string();
+        try {
+            job.frames = std::stol(words[framesField]);
+        } catch (const std::out_of_range&) {
+            throw std::runtime_error("Frame count out of range in '" + line + "'");
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+JobResult runJob(const Job& job, const std::string& outDirectory, size_t index) {
+    JobResult result;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        std::vector<ScriptEvent> events;
+        if (!job.script.empty()) {
+            events = readInputScript(job.script);
+        }
+
+        Cartridge cartridge(job.rom);
+        CountingFrameSink sink;
+        Gameboy emu(cartridge, sink);
+
+        size_t nextEvent = 0;
+        for (long frame = 0; frame < job.frames; frame++) {
+            for (; nextEvent < events.size() && events[nextEvent].frame <= frame; nextEvent++) {
+                if (events[nextEvent].pressed) {
+                    emu.handleKeyDown(events[nextEvent].button);
+                } else {
+                    emu.handleKeyUp(events[nextEvent].button);
+                }
+            }
+            emu.runFrame();
+        }
+
+        // Nothing else reads the ring, so the latest frame is the last one presented
+        const FrameBuffer& frame = emu.getFrameRing().acquireLatest();
+        result.framesPresented = sink.frames;
+        result.frameHash = sink.frames > 0 ? hashBytes(frame.data(), frame.size()) : 0;
+        result.wramHash = hashBytes(emu.getWram().data(), emu.getWram().size());
+
+        if (!outDirectory.empty()) {
+            fs::path prefix = fs::path(outDirectory) / ("job" + std::to_string(index));
+            std::ofstream wram(prefix.string() + ".wram", std::ios::binary);
+            wram.write(reinterpret_cast<const char*>(emu.getWram().data()), emu.getWram().size());
+            if (!cartridge.getRam().empty()) {
+                std::ofstream sram(prefix.string() + ".sram", std::ios::binary);
+                sram.write(reinterpret_cast<const char*>(cartridge.getRam().data()), cartridge.getRam().size());
+            }
+        }
+        result.ok = true;
+    } catch (const std::exception& exception) {
+        result.error = exception.what();
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+void writeResults(std::ostream& out, const std::vector<Job>& jobs, const std::vector<JobResult>& results) {
+    out << "job,rom,frames,frames_presented,frame_hash,wram_hash,seconds,status" << std::endl;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const JobResult& result = results[i];
+        out << i << ",\"" << jobs[i].rom << "\"," << jobs[i].frames << "," << result.framesPresented << ","
+            << std::hex << std::setw(16) << std::setfill('0') << result.frameHash << ","
+            << std::setw(16) << result.wramHash << std::dec << std::setfill(' ') << ","
+            << result.seconds << ",\"" << (result.ok ? "ok" : result.error) << "\"" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cout << "Invalid Input. Usage: ./gameboy_batch {manifest} [--threads n] [--out directory]\n";
+        return 0;
+    }
+
+    std::string manifest = argv[1];
+    size_t numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::string outDirectory;
+    std::vector<Job> jobs;
+    try {
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--threads" && i + 1 < argc) {
+                std::string count = argv[++i];
+                try {
+                    numThreads = std::max(std::stoul(count), 1ul);
+                } catch (const std::logic_error&) {
+                    throw std::runtime_error("Invalid thread count '" + count + "'");
+                }
+            } else if (arg == "--out" && i + 1 < argc) {
+                outDirectory = argv[++i];
+            } else {
+                std::cout << "Invalid flag " << arg << std::endl;
+                return 0;
+            }
+        }
+
+        jobs = readManifest(manifest);
+        if (!outDirectory.empty()) {
+            fs::create_directories(outDirectory);
+        }
+    } catch (const std::exception& exception) {
+        // A bad thread count, an unreadable manifest or output directory
+        std::cerr << "Error: " << exception.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<JobResult> results(jobs.size());
+    auto start = std::chrono::steady_clock::now();
+    WorkStealingPool pool(std::min(numThreads, std::max(jobs.size(), size_t{1})));
+    pool.run(jobs.size(), [&](size_t index) {
+        results[index] = runJob(jobs[index], outDirectory, index);
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    writeResults(std::cout, jobs, results);
+    if (!outDirectory.empty()) {
+        std::ofstream csv(fs::path(outDirectory) / "results.csv");
+        writeResults(csv, jobs, results);
+    }
+
+    long totalFrames = 0;
+    size_t failed = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        totalFrames += results[i].ok ? jobs[i].frames : 0;
+        failed += results[i].ok ? 0 : 1;
+    }
+    std::cerr << "Ran " << jobs.size() << " jobs (" << failed << " failed) on " << numThreads << " threads in "
+              << seconds << " s, " << totalFrames / seconds << " frames/sec" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -1,35 +1,121 @@
 // Empty file for now, will implement later
 #include <cartridge.hpp>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+std::vector<uint8_t> readRomFile(const std::string& fileName) {
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file.");
+    }
+
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    std::vector<uint8_t> buffer(size);
+
+    if (!file.read(reinterpret_cast<char*>(buffer.data()), size)) {
+        throw std::runtime_error("Failed to read file.");
+    }
+
+    return buffer;
+}
+
+void Cartridge::initialize() {
+    // Extract info from cartridge. The checked reads go first so a file too short to
+    // have a header throws
+    mbcType = getMBCType(rom.at(0x0147));
+    battery = hasBattery(rom.at(0x0147));
+    rtc = hasRtc(rom.at(0x0147));
+    title.assign(rom.begin() + 0x0134, rom.begin() + 0x0143);
+    romSize = rom.size();
+    // MBC2 RAM is built into the chip, the header says there is none
+    ramSize = (mbcType == MBCType::MBC2) ? MBC2_RAM_SIZE : getRamSize(rom.at(0x0149));
+    ramBuffer.resize(ramSize, 0);
+    ram = ramBuffer;
+
+    // Initialize MBC
+    createMapper();
+}
 
 MBCType Cartridge::getMBCType(uint8_t code) {
     switch (code) {
         case 0x0: return MBCType::ROM_ONLY;
         case 0x1: return MBCType::MBC1;
         case 0x2: return MBCType::MBC1_WITH_RAM;
+        case 0x3: return MBCType::MBC1_WITH_RAM; // With battery
         case 0x5: return MBCType::MBC2;
+        case 0x6: return MBCType::MBC2; // With battery
+        case 0x0F: return MBCType::MBC3; // Timer and battery
+        case 0x10: return MBCType::MBC3; // Timer, RAM and battery
+        case 0x11: return MBCType::MBC3;
+        case 0x12: return MBCType::MBC3; // With RAM
+        case 0x13: return MBCType::MBC3; // With RAM and battery
+        case 0x19: return MBCType::MBC5;
+        case 0x1A: return MBCType::MBC5; // With RAM
+        case 0x1B: return MBCType::MBC5; // With RAM and battery
+        case 0x1C: return MBCType::MBC5; // With rumble
+        case 0x1D: return MBCType::MBC5; // With rumble and RAM
+        case 0x1E: return MBCType::MBC5; // With rumble, RAM and battery
         default: return MBCType::UNSUPPORTED;
     }
 }
 
-unique_ptr<MBC> Cartridge::getMBC(MBCType mbcType) {
+bool Cartridge::hasBattery(uint8_t code) {
+    switch (code) {
+        case 0x3: return true;
+        case 0x6: return true;
+        case 0x0F: return true;
+        case 0x10: return true;
+        case 0x13: return true;
+        case 0x1B: return true;
+        case 0x1E: return true;
+        default: return false;
+    }
+}
+
+bool Cartridge::hasRtc(uint8_t code) {
+    return code == 0x0F || code == 0x10;
+}
+
+bool Cartridge::openSaveFile() {
+    if (!battery || (ramSize == 0 && !rtc)) {
+        return false;
+    }
+    std::string path = std::filesystem::path(filename).replace_extension(".sav").string();
+    size_t footerSize = rtc ? MBC3::RTC_FOOTER_SIZE : 0;
+    saveFile = std::make_unique<MappedFile>(path, ramSize + footerSize);
+    ram = Span<uint8_t>(saveFile->data(), ramSize);
+    rtcFooter = Span<uint8_t>(saveFile->data() + ramSize, footerSize);
+    ramBuffer.clear();
+    ramBuffer.shrink_to_fit();
+    createMapper();
+    return true;
+}
+
+void Cartridge::createMapper() {
     switch (mbcType) {
-        case MBCType::ROM_ONLY: return make_unique<ROMOnly>(rom);
-        case MBCType::MBC1: return make_unique<MBC1>(rom, ram);
-        case MBCType::MBC1_WITH_RAM: return make_unique<MBC1>(rom, ram);
-        case MBCType::MBC2: return make_unique<MBC2>(rom, ram);
-        default: return make_unique<ROMOnly>(rom); // Fallback for unsupported MBCs
+        case MBCType::ROM_ONLY: mbc.emplace<ROMOnly>(rom); break;
+        case MBCType::MBC1: mbc.emplace<MBC1>(rom, ram); break;
+        case MBCType::MBC1_WITH_RAM: mbc.emplace<MBC1>(rom, ram); break;
+        case MBCType::MBC2: mbc.emplace<MBC2>(rom, ram); break;
+        case MBCType::MBC3: mbc.emplace<MBC3>(rom, ram, rtcFooter, clock); break;
+        case MBCType::MBC5: mbc.emplace<MBC5>(rom, ram); break;
+        default: mbc.emplace<ROMOnly>(rom); break; // Fallback for unsupported MBCs
     }
 }
 
 size_t Cartridge::getRamSize(uint8_t code) {
     switch (code) {
         case 0x0: return 0;
-        case 0x2: return KILOBYTE_SIZE;
-        case 0x3: return 4 * KILOBYTE_SIZE;
-        case 0x4: return 16 * KILOBYTE_SIZE;
-        case 0x5: return 8 * KILOBYTE_SIZE;
-        case 0x6: return 512; // MBC2 has 512 Bytes of RAM
-        default: assert(false && "Unknown RAM Code");
+        case 0x1: return 2 * KILOBYTE_SIZE;
+        case 0x2: return 8 * KILOBYTE_SIZE;
+        case 0x3: return 32 * KILOBYTE_SIZE; // 4 banks of 8 KB
+        case 0x4: return 128 * KILOBYTE_SIZE; // 16 banks of 8 KB
+        case 0x5: return 64 * KILOBYTE_SIZE; // 8 banks of 8 KB
+        default: throw std::runtime_error("Unknown RAM size code");
     }
 }
 
@@ -39,6 +125,8 @@ std::string Cartridge::getMBCString(MBCType mbcType) {
         case MBCType::MBC1: return "MBC1";
         case MBCType::MBC1_WITH_RAM: return "MBC1_WITH_RAM";
         case MBCType::MBC2: return "MBC2";
+        case MBCType::MBC3: return "MBC3";
+        case MBCType::MBC5: return "MBC5";
         default: return "UNSUPPORTED";
     }
 }
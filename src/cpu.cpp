@@ -1,26 +1,13 @@
 #include "cpu.hpp"
+#include "jit.hpp"
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <utility>
 
 // Getters & Setters
 
 // r8
-R8 CPU::getR8(uint8_t registerNum) {
-    assert(registerNum < 8);
-    switch (registerNum) {
-        case 0: return R8::B;
-        case 1: return R8::C;
-        case 2: return R8::D;
-        case 3: return R8::E;
-        case 4: return R8::H;
-        case 5: return R8::L;
-        case 6: return R8::HL_ADDR;
-        case 7: return R8::A;
-        default:
-            assert(false && "Invalid R8 index");
-            return R8::A;
-    }
-}
 uint8_t CPU::getR8Value(R8 r8) {
     switch (r8) {
         case R8::B: return registers.B;
@@ -50,18 +37,6 @@ void CPU::setR8Value(R8 r8, uint8_t value) {
 }
 
 // r16
-R16 CPU::getR16(uint8_t registerNum) {
-    assert(registerNum < 4);
-    switch (registerNum) {
-        case 0: return R16::BC;
-        case 1: return R16::DE;
-        case 2: return R16::HL;
-        case 3: return R16::SP;
-        default:
-            assert(false && "Invalid R16 index");
-            return R16::SP;
-    }
-}
 uint16_t CPU::getR16Value(R16 r16) {
     switch (r16) {
         case R16::BC: return static_cast<uint16_t>((registers.B << 8) | registers.C);
@@ -83,19 +58,6 @@ void CPU::setR16Value(R16 r16, uint16_t value) {
     }
 }
 // [r16mem]
-R16MEM CPU::getR16MEM(uint8_t registerNum) {
-    assert(registerNum < 4);
-    // BC, DE, HLI, HLD
-    switch (registerNum) {
-        case 0: return R16MEM::BC;
-        case 1: return R16MEM::DE;
-        case 2: return R16MEM::HLI;
-        case 3: return R16MEM::HLD;
-        default:
-            assert(false && "Invalid R16MEM index");
-            return R16MEM::HLD;
-    }
-}
 uint8_t CPU::getR16MEMValue(R16MEM r16Mem) {
     uint16_t address = 0xFEA0; // init to unused memory
 
@@ -133,18 +95,6 @@ void CPU::setR16MEMValue(R16MEM r16Mem, uint8_t value) {
     bus.write(address, value);
 }
 // r16stk
-R16STK CPU::getR16STK(uint8_t registerNum) {
-    assert(registerNum < 4);
-    switch (registerNum) {
-        case 0: return R16STK::BC;
-        case 1: return R16STK::DE;
-        case 2: return R16STK::HL;
-        case 3: return R16STK::AF;
-        default:
-            assert(false && "Invalid R16STK index");
-            return R16STK::AF;
-    }
-}
 uint16_t CPU::getR16STKValue(R16STK r16Mem) {
     switch (r16Mem) {
         case R16STK::BC: return getR16Value(R16::BC);
@@ -248,37 +198,446 @@ uint8_t CPU::popStack() {
     return bus.read(SP++);
 }
 
-// Block 0-3
-int CPU::cycle() {
+// Dispatch
+template <R8 r8>
+uint8_t CPU::readR8() {
+    if constexpr (r8 == R8::B) return registers.B;
+    else if constexpr (r8 == R8::C) return registers.C;
+    else if constexpr (r8 == R8::D) return registers.D;
+    else if constexpr (r8 == R8::E) return registers.E;
+    else if constexpr (r8 == R8::H) return registers.H;
+    else if constexpr (r8 == R8::L) return registers.L;
+    else if constexpr (r8 == R8::HL_ADDR) return bus.read(registers.H << 8 | registers.L);
+    else if constexpr (r8 == R8::A) return registers.A;
+    else return registers.F;
+}
+template <R8 r8>
+void CPU::writeR8(uint8_t value) {
+    if constexpr (r8 == R8::B) registers.B = value;
+    else if constexpr (r8 == R8::C) registers.C = value;
+    else if constexpr (r8 == R8::D) registers.D = value;
+    else if constexpr (r8 == R8::E) registers.E = value;
+    else if constexpr (r8 == R8::H) registers.H = value;
+    else if constexpr (r8 == R8::L) registers.L = value;
+    else if constexpr (r8 == R8::HL_ADDR) bus.write(registers.H << 8 | registers.L, value);
+    else if constexpr (r8 == R8::A) registers.A = value;
+    else registers.F = value;
+}
+
+uint16_t CPU::fetchOperand(uint8_t length) {
+    switch (length) {
+        case 2: return loadImm8();
+        case 3: return loadImm16();
+        default: return 0;
+    }
+}
+
+// Every opcode is decoded at compile time from its bit pattern
+// Naming follows https://gbdev.io/pandocs/CPU_Instruction_Set.html:
+// x = bits 7-6 (block), y = bits 5-3, z = bits 2-0, p = y >> 1, q = y & 1
+template <uint8_t OPCODE>
+int CPU::execute(uint16_t operand) {
+    constexpr uint8_t x = OPCODE >> 6;
+    constexpr uint8_t y = (OPCODE >> 3) & 0b111;
+    constexpr uint8_t z = OPCODE & 0b111;
+    constexpr uint8_t p = y >> 1;
+    constexpr uint8_t q = y & 1;
+
+    const uint8_t imm8 = static_cast<uint8_t>(operand);
+    const int8_t e8 = static_cast<int8_t>(operand);
+
+    if constexpr (x == 0) {
+        if constexpr (z == 0) {
+            if constexpr (y == 0) { NOOP(); return 4; }
+            else if constexpr (y == 1) { LD_IMM16MEM_SP(operand); return 20; }
+            else if constexpr (y == 2) { STOP(); return 4; }
+            else if constexpr (y == 3) { JR_IMM8(e8); return 12; }
+            else {
+                constexpr COND condition = static_cast<COND>(y - 4);
+                bool taken = evaluateCondition(condition);
+                JR_COND_IMM8(condition, e8);
+                return taken ? 12 : 8;
+            }
+        } else if constexpr (z == 1) {
+            constexpr R16 r16 = getR16(p);
+            if constexpr (q == 0) { LD_R16_IMM16(r16, operand); return 12; }
+            else { ADD_HL_R16(r16); return 8; }
+        } else if constexpr (z == 2) {
+            constexpr R16MEM r16Mem = getR16MEM(p);
+            if constexpr (q == 0) LD_R16MEM_A(r16Mem);
+            else LD_A_R16MEM(r16Mem);
+            return 8;
+        } else if constexpr (z == 3) {
+            constexpr R16 r16 = getR16(p);
+            if constexpr (q == 0) INC_R16(r16);
+            else DEC_R16(r16);
+            return 8;
+        } else if constexpr (z == 4 || z == 5 || z == 6) {
+            constexpr R8 r8 = getR8(y);
+            if constexpr (z == 4) INC_R8(r8);
+            else if constexpr (z == 5) DEC_R8(r8);
+            else LD_R8_IMM8(r8, imm8);
+
+            if constexpr (r8 == R8::HL_ADDR) return 12;
+            else if constexpr (z == 6) return 8;
+            else return 4;
+        } else {
+            if constexpr (y == 0) RLCA();
+            else if constexpr (y == 1) RRCA();
+            else if constexpr (y == 2) RLA();
+            else if constexpr (y == 3) RRA();
+            else if constexpr (y == 4) DAA();
+            else if constexpr (y == 5) CPL();
+            else if constexpr (y == 6) SCF();
+            else CCF();
+            return 4;
+        }
+    } else if constexpr (x == 1) {
+        if constexpr (OPCODE == 0x76) {
+            // TODO handle halt bug
+            halted = true;
+            return 4;
+        } else {
+            // LD r8, r8
+            constexpr R8 dst = getR8(y);
+            constexpr R8 src = getR8(z);
+            writeR8<dst>(readR8<src>());
+            return (src == R8::HL_ADDR || dst == R8::HL_ADDR) ? 8 : 4;
+        }
+    } else if constexpr (x == 2) {
+        // OPERATION a, r8
+        constexpr R8 r8 = getR8(z);
+        executeALU<y>(readR8<r8>());
+        return (r8 == R8::HL_ADDR) ? 8 : 4;
+    } else {
+        if constexpr (z == 0) {
+            if constexpr (y < 4) {
+                constexpr COND condition = static_cast<COND>(y);
+                bool taken = evaluateCondition(condition);
+                RET_COND(condition);
+                return taken ? 20 : 8;
+            }
+            else if constexpr (y == 4) { LDH_IMM8MEM_A(imm8); return 12; }
+            else if constexpr (y == 5) { ADD_SP_E8(e8); return 16; }
+            else if constexpr (y == 6) { LDH_A_IMM8MEM(imm8); return 12; }
+            else { LD_HL_SP_PLUS_E8(e8); return 12; }
+        } else if constexpr (z == 1) {
+            if constexpr (q == 0) { POP_R16STK(getR16STK(p)); return 12; }
+            else if constexpr (p == 0) { RET(); return 16; }
+            else if constexpr (p == 1) { RETI(); return 16; }
+            else if constexpr (p == 2) { JP_HL(); return 4; }
+            else { LD_SP_HL(); return 8; }
+        } else if constexpr (z == 2) {
+            if constexpr (y < 4) {
+                constexpr COND condition = static_cast<COND>(y);
+                bool taken = evaluateCondition(condition);
+                JP_COND_IMM16(condition, operand);
+                return taken ? 16 : 12;
+            }
+            else if constexpr (y == 4) { LDH_CMEM_A(); return 8; }
+            else if constexpr (y == 5) { LD_IMM16MEM_A(operand); return 16; }
+            else if constexpr (y == 6) { LDH_A_CMEM(); return 8; }
+            else { LD_A_IMM16MEM(operand); return 16; }
+        } else if constexpr (z == 3) {
+            if constexpr (y == 0) { JP_IMM16(operand); return 16; }
+            else if constexpr (y == 1) { return (this->*CB_TABLE[imm8])(0); }
+            else if constexpr (y == 6) { DI(); return 4; }
+            else if constexpr (y == 7) { EI(); return 4; }
+            else { return executeInvalid(); }
+        } else if constexpr (z == 4) {
+            if constexpr (y < 4) {
+                constexpr COND condition = static_cast<COND>(y);
+                bool taken = evaluateCondition(condition);
+                CALL_COND_IMM16(condition, operand);
+                return taken ? 24 : 12;
+            }
+            else { return executeInvalid(); }
+        } else if constexpr (z == 5) {
+            if constexpr (q == 0) { PUSH_R16STK(getR16STK(p)); return 16; }
+            else if constexpr (p == 0) { CALL_IMM16(operand); return 24; }
+            else { return executeInvalid(); }
+        } else if constexpr (z == 6) {
+            executeALU<y>(imm8);
+            return 8;
+        } else {
+            RST_TGT3(y * 8);
+            return 16;
+        }
+    }
+}
+
+template <uint8_t OPCODE>
+int CPU::executeCB(uint16_t operand) {
+    constexpr uint8_t x = OPCODE >> 6;
+    constexpr uint8_t y = (OPCODE >> 3) & 0b111;
+    constexpr R8 targetRegister = getR8(OPCODE & 0b111);
+
+    if constexpr (x == 0) {
+        // Rotates and Shifts
+        if constexpr (y == 0) RLC(targetRegister);
+        else if constexpr (y == 1) RRC(targetRegister);
+        else if constexpr (y == 2) RL(targetRegister);
+        else if constexpr (y == 3) RR(targetRegister);
+        else if constexpr (y == 4) SLA(targetRegister);
+        else if constexpr (y == 5) SRA(targetRegister);
+        else if constexpr (y == 6) SWAP(targetRegister);
+        else SRL(targetRegister);
+    }
+    else if constexpr (x == 1) BIT(y, targetRegister);
+    else if constexpr (x == 2) RES(y, targetRegister);
+    else SET(y, targetRegister);
+
+    if constexpr (targetRegister == R8::HL_ADDR) {
+        return (x == 1) ? 12 : 16; // BIT only reads [HL]
+    } else {
+        return 8;
+    }
+}
+
+template <uint8_t OPERATION>
+void CPU::executeALU(uint8_t value) {
+    if constexpr (OPERATION == 0) ADD(value);
+    else if constexpr (OPERATION == 1) ADC(value);
+    else if constexpr (OPERATION == 2) SUB(value);
+    else if constexpr (OPERATION == 3) SBC(value);
+    else if constexpr (OPERATION == 4) AND(value);
+    else if constexpr (OPERATION == 5) XOR(value);
+    else if constexpr (OPERATION == 6) OR(value);
+    else CP(value);
+}
+
+int CPU::executeInvalid() {
+    assert(false && "Invalid opcode");
+    return 0;
+}
+
+// Instruction lengths in bytes including the opcode, 0xCB counts its second byte
+static constexpr uint8_t getOpcodeLength(uint8_t opcode) {
+    switch (opcode) {
+        case 0x01: case 0x11: case 0x21: case 0x31: // LD r16, imm16
+        case 0x08: // LD [imm16], SP
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA: // JP cond, imm16
+        case 0xC3: // JP imm16
+        case 0xC4: case 0xCC: case 0xD4: case 0xDC: // CALL cond, imm16
+        case 0xCD: // CALL imm16
+        case 0xEA: case 0xFA: // LD [imm16], A / LD A, [imm16]
+            return 3;
+        case 0x06: case 0x0E: case 0x16: case 0x1E: // LD r8, imm8
+        case 0x26: case 0x2E: case 0x36: case 0x3E:
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE: // ALU imm8
+        case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+        case 0xE0: case 0xF0: // LDH
+        case 0xE8: case 0xF8: // SP + e8
+        case 0xCB:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+template <size_t... OPCODES>
+constexpr std::array<CPU::Handler, 256> CPU::buildOpcodeTable(std::index_sequence<OPCODES...>) {
+    return {&CPU::execute<OPCODES>...};
+}
+template <size_t... OPCODES>
+constexpr std::array<CPU::Handler, 256> CPU::buildCBTable(std::index_sequence<OPCODES...>) {
+    return {&CPU::executeCB<OPCODES>...};
+}
+template <size_t... OPCODES>
+constexpr std::array<uint8_t, 256> CPU::buildOpcodeLengths(std::index_sequence<OPCODES...>) {
+    return {getOpcodeLength(OPCODES)...};
+}
+
+const std::array<CPU::Handler, 256> CPU::OPCODE_TABLE = CPU::buildOpcodeTable(std::make_index_sequence<256>{});
+const std::array<CPU::Handler, 256> CPU::CB_TABLE = CPU::buildCBTable(std::make_index_sequence<256>{});
+const std::array<uint8_t, 256> CPU::OPCODE_LENGTHS = CPU::buildOpcodeLengths(std::make_index_sequence<256>{});
+
+int CPU::cycle(int cycleBudget) {
     handleInterrupts();
 
     if (enableInterruptsNextInstruction) {
         interruptsEnabled = true;
         enableInterruptsNextInstruction = false;
+        // Interrupts are checked again after just one instruction, so a compiled
+        // block must not run past it
+        cycleBudget = 1;
     }
 
     if (!halted) {
-        uint8_t opcode = bus.read(PC++);
-        // cout << "Executing opcode " << std::hex << static_cast<int>(opcode) << endl;
-        return executeInstruction(opcode);
-    } else {
-        return 4; // Cycles for a halted CPU
+        return executeNext(cycleBudget);
+    }
+    // Interrupts are only raised by scheduled events and by writes, and a halted CPU
+    // writes nothing - so nothing can wake it before the budget runs out. Rounded up to
+    // whole machine cycles, which is where a CPU stepping through HALT would land
+    return std::max((cycleBudget + 3) & ~3, 4);
+}
+bool CPU::endsBlock(uint8_t opcode) {
+    switch (opcode) {
+        case 0x10: // STOP
+        case 0x18: // JR e8
+        case 0x76: // HALT
+        case 0xC3: // JP imm16
+        case 0xC9: // RET
+        case 0xCD: // CALL imm16
+        case 0xD9: // RETI
+        case 0xE9: // JP HL
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF: // RST
+        case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+        case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: // Invalid
+        case 0xEB: case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+            return true;
+        default:
+            return false;
+    }
+}
+
+CPU::DecodedBlock* CPU::findBlock(uint16_t address) {
+    const uint8_t* code = bus.getRomPointer(address);
+    if (!code) {
+        return nullptr;
+    }
+
+    BlockKey key{code, address};
+    auto existing = blockCache.find(key);
+    if (existing != blockCache.end()) {
+        return &existing->second;
+    }
+
+    // Decode up to the end of the 16 KB bank, the next one may be mapped elsewhere
+    size_t available = 0x4000 - (address & 0x3FFF);
+    DecodedBlock block;
+    size_t offset = 0;
+    while (block.instructions.size() < MAX_BLOCK_INSTRUCTIONS) {
+        uint8_t opcode = code[offset];
+        uint8_t length = OPCODE_LENGTHS[opcode];
+        if (offset + length > available) {
+            break;
+        }
+
+        DecodedInstruction instruction{OPCODE_TABLE[opcode], 0, opcode, length};
+        if (length == 2) {
+            instruction.operand = code[offset + 1];
+        } else if (length == 3) {
+            instruction.operand = static_cast<uint16_t>(code[offset + 1] | (code[offset + 2] << 8));
+        }
+        if (opcode == 0xCB) {
+            instruction.handler = CB_TABLE[instruction.operand];
+        }
+        block.instructions.push_back(instruction);
+        offset += length;
+
+        if (endsBlock(opcode)) {
+            break;
+        }
+    }
+
+    if (block.instructions.empty()) {
+        return nullptr;
+    }
+    return &blockCache.emplace(key, std::move(block)).first->second;
+}
+
+int CPU::executeNext(int cycleBudget) {
+    instructionCount++;
+    // Leave the current block after a jump, an interrupt or a bank switch
+    bool inBlock = currentBlock &&
+        PC == blockPC &&
+        blockPosition < currentBlock->instructions.size() &&
+        blockMappingVersion == bus.getMappingVersion();
+
+    if (!inBlock) {
+        currentBlock = findBlock(PC);
+        blockPosition = 0;
+        blockMappingVersion = bus.getMappingVersion();
+
+        if (!currentBlock) {
+            uint8_t opcode = bus.read(PC++);
+            // cout << "Executing opcode " << std::hex << static_cast<int>(opcode) << endl;
+            return executeInstruction(opcode);
+        }
+
+#ifdef GAMEBOY_JIT
+        if (JitFunction jitCode = getJitCode(*currentBlock, PC)) {
+            // Compiled blocks count their own instructions
+            instructionCount--;
+            currentBlock = nullptr;
+            return jitCode(this, cycleBudget);
+        }
+#endif
+    }
+
+    const DecodedInstruction& instruction = currentBlock->instructions[blockPosition++];
+    PC += instruction.length;
+    blockPC = PC;
+    return (this->*instruction.handler)(instruction.operand);
+}
+
+#ifdef GAMEBOY_JIT
+
+template <uint8_t OPCODE>
+int CPU::executeThunk(CPU* cpu, uint16_t operand) {
+    return cpu->execute<OPCODE>(operand);
+}
+template <uint8_t OPCODE>
+int CPU::executeCBThunk(CPU* cpu, uint16_t operand) {
+    return cpu->executeCB<OPCODE>(operand);
+}
+template <size_t... OPCODES>
+constexpr std::array<CPU::Thunk, 256> CPU::buildThunkTable(std::index_sequence<OPCODES...>) {
+    return {&CPU::executeThunk<OPCODES>...};
+}
+template <size_t... OPCODES>
+constexpr std::array<CPU::Thunk, 256> CPU::buildCBThunkTable(std::index_sequence<OPCODES...>) {
+    return {&CPU::executeCBThunk<OPCODES>...};
+}
+
+const std::array<CPU::Thunk, 256> CPU::OPCODE_THUNKS = CPU::buildThunkTable(std::make_index_sequence<256>{});
+const std::array<CPU::Thunk, 256> CPU::CB_THUNKS = CPU::buildCBThunkTable(std::make_index_sequence<256>{});
+
+JitFunction CPU::getJitCode(DecodedBlock& block, uint16_t address) {
+    if (!jitEnabled || block.jitCode) {
+        return block.jitCode;
+    }
+    if (++block.executionCount < JIT_COMPILE_THRESHOLD) {
+        return nullptr;
     }
+
+    if (!jit->hasSpace(block.instructions.size())) {
+        // Out of code space - start over and let hot blocks get compiled again
+        jit->reset();
+        for (auto& entry : blockCache) {
+            entry.second.jitCode = nullptr;
+            entry.second.executionCount = 0;
+        }
+    }
+    block.jitCode = jit->compile(address, block);
+    return block.jitCode;
 }
+
+#endif
+
 void CPU::handleInterrupts() {
-    if (!interruptsEnabled) {
+    if (!interruptsEnabled && !halted) {
         return;
     }
 
     uint8_t interruptFlags = bus.read(0xFF0F);
     uint8_t enabledInterrupts = bus.read(0xFFFF);
 
-    uint8_t pendingInterrupts = enabledInterrupts & interruptFlags;
+    uint8_t pendingInterrupts = enabledInterrupts & interruptFlags & 0x1F;
 
     if (!pendingInterrupts) {
         return;
     }
 
+    // Any pending interrupt ends HALT. With interrupts disabled the CPU carries on
+    // after the HALT without servicing it
+    halted = false;
+    if (!interruptsEnabled) {
+        return;
+    }
+
     interruptsEnabled = false;
 
     // Call in order of priority and clear flag
@@ -300,292 +659,44 @@ void CPU::handleInterrupts() {
         CALL_IMM16(0x0060);
     }
 }
+
+#if defined(GAMEBOY_COMPUTED_GOTO) && (defined(__GNUC__) || defined(__clang__))
+
+// Expands M once per opcode as a hex literal, 0x00 to 0xFF
+#define OPCODES_16(M, hi) \
+    M(hi##0) M(hi##1) M(hi##2) M(hi##3) M(hi##4) M(hi##5) M(hi##6) M(hi##7) \
+    M(hi##8) M(hi##9) M(hi##A) M(hi##B) M(hi##C) M(hi##D) M(hi##E) M(hi##F)
+#define OPCODES_256(M) \
+    OPCODES_16(M, 0x0) OPCODES_16(M, 0x1) OPCODES_16(M, 0x2) OPCODES_16(M, 0x3) \
+    OPCODES_16(M, 0x4) OPCODES_16(M, 0x5) OPCODES_16(M, 0x6) OPCODES_16(M, 0x7) \
+    OPCODES_16(M, 0x8) OPCODES_16(M, 0x9) OPCODES_16(M, 0xA) OPCODES_16(M, 0xB) \
+    OPCODES_16(M, 0xC) OPCODES_16(M, 0xD) OPCODES_16(M, 0xE) OPCODES_16(M, 0xF)
+
+#define OPCODE_LABEL_ADDRESS(opcode) &&opcode_##opcode,
+#define OPCODE_LABEL(opcode) opcode_##opcode: return execute<opcode>(operand);
+
+// Jumps straight to an inlined copy of each handler instead of calling through the table
 int CPU::executeInstruction(uint8_t opcode) {
-    if (opcode == 0xCB) {
-        uint8_t cbOpcode = bus.read(PC++);
-        return executeBlockCB(cbOpcode);
-    } else {
-        uint8_t block = (opcode >> 6);
-        switch (block) {
-            case 0: return executeBlock0(opcode);
-            case 1: return executeBlock1(opcode);
-            case 2: return executeBlock2(opcode);
-            case 3: return executeBlock3(opcode);
-            default: assert(false && "Invalid block"); return 0;
-        }
-    }
-}
-int CPU::executeBlock0(uint8_t opcode) {
-    switch (opcode) {
-        case 0x00: // NOP
-            return 4;
-        case 0x01: // LD BC, imm16
-            LD_R16_IMM16(R16::BC, loadImm16());
-            return 12;
-        case 0x02: // LD [BC], A
-            LD_R16MEM_A(R16MEM::BC);
-            return 8;
-        case 0x03: // INC BC
-            INC_R16(R16::BC);
-            return 8;
-        case 0x04: // INC B
-            INC_R8(R8::B);
-            return 4;
-        case 0x05: // DEC B
-            DEC_R8(R8::B);
-            return 4;
-        case 0x06: // LD B, n8
-            LD_R8_IMM8(R8::B, loadImm8());
-            return 8;
-        case 0x07: // RLCA
-            RLCA();
-            return 4;
-        case 0x08: // LD [imm16],SP
-            LD_IMM16MEM_SP(loadImm16());
-            return 20;
-        case 0x09: // ADD HL, BC
-            ADD_HL_R16(R16::BC);
-            return 8;
-        case 0x0A: // LD A, [BC]
-            LD_A_R16MEM(R16MEM::BC);
-            return 8;
-        case 0x0B: // DEC BC
-            DEC_R16(R16::BC);
-            return 8;
-        case 0x0C: // INC C
-            INC_R8(R8::C);
-            return 4;
-        case 0x0D: // DEC C
-            DEC_R8(R8::C);
-            return 4;
-        case 0x0E: // LD C, imm8
-            LD_R8_IMM8(R8::C, loadImm8());
-            return 8;
-        case 0x0F: // RRCA
-            RRCA();
-            return 4;
-        case 0x10: // STOP
-            STOP();
-            return 4;
-        case 0x11: // LD DE, n16
-            LD_R16_IMM16(R16::DE, loadImm16());
-            return 12;
-        case 0x12: // LD [DE], A
-            LD_R16MEM_A(R16MEM::DE);
-            return 8;
-        case 0x13: // INC DE
-            INC_R16(R16::DE);
-            return 8;
-        case 0x14: // INC D
-            INC_R8(R8::D);
-            return 4;
-        case 0x15: // DEC D
-            DEC_R8(R8::D);
-            return 4;
-        case 0x16: // LD D, imm8
-            LD_R8_IMM8(R8::D, loadImm8());
-            return 8;
-        case 0x17: // RLA
-            RLA();
-            return 4;
-        case 0x18: // JR e8
-            JR_IMM8(loadE8());
-            return 12;
-        case 0x19: // ADD HL, DE
-            ADD_HL_R16(R16::DE);
-            return 8;
-        case 0x1A: // LD A, [DE]
-            LD_A_R16MEM(R16MEM::DE);
-            return 8;
-        case 0x1B: // DEC DE
-            DEC_R16(R16::DE);
-            return 8;
-        case 0x1C: // INC E
-            INC_R8(R8::E);
-            return 4;
-        case 0x1D: // DEC E
-            DEC_R8(R8::E);
-            return 4;
-        case 0x1E: // LD E, imm8
-            LD_R8_IMM8(R8::E, loadImm8());
-            return 8;
-        case 0x1F: // RRA
-            RRA();
-            return 4;
-        case 0x20: JR_COND_IMM8(COND::NZ, loadE8()); return evaluateCondition(COND::NZ) ? 12 : 8;
-        case 0x21: LD_R16_IMM16(R16::HL, loadImm16()); return 12;
-        case 0x22: LD_R16MEM_A(R16MEM::HLI); return 8;
-        case 0x23: INC_R16(R16::HL); return 8;
-        case 0x24: INC_R8(R8::H); return 4;
-        case 0x25: DEC_R8(R8::H); return 4;
-        case 0x26: LD_R8_IMM8(R8::H, loadImm8()); return 8;
-        case 0x27: DAA(); return 4;
-        case 0x28: JR_COND_IMM8(COND::Z, loadE8()); return evaluateCondition(COND::Z) ? 12 : 8;
-        case 0x29: ADD_HL_R16(R16::HL); return 8;
-        case 0x2A: LD_A_R16MEM(R16MEM::HLI); return 8;
-        case 0x2B: DEC_R16(R16::HL); return 8;
-        case 0x2C: INC_R8(R8::L); return 4;
-        case 0x2D: DEC_R8(R8::L); return 4;
-        case 0x2E: LD_R8_IMM8(R8::L, loadImm8()); return 8;
-        case 0x2F: CPL(); return 4;
-        case 0x30: JR_COND_IMM8(COND::NC, loadE8()); return evaluateCondition(COND::NC) ? 12 : 8;
-        case 0x31: LD_R16_IMM16(R16::SP, loadImm16()); return 12;
-        case 0x32: LD_R16MEM_A(R16MEM::HLD); return 8;
-        case 0x33: INC_R16(R16::SP); return 8;
-        case 0x34: INC_R8(R8::HL_ADDR); return 12;
-        case 0x35: DEC_R8(R8::HL_ADDR); return 12;
-        case 0x36: LD_R8_IMM8(R8::HL_ADDR, loadImm8()); return 12;
-        case 0x37: SCF(); return 4;
-        case 0x38: JR_COND_IMM8(COND::C, loadE8()); return evaluateCondition(COND::C) ? 12 : 8;
-        case 0x39: ADD_HL_R16(R16::SP); return 8;
-        case 0x3A: LD_A_R16MEM(R16MEM::HLD); return 8;
-        case 0x3B: DEC_R16(R16::SP); return 8;
-        case 0x3C: INC_R8(R8::A); return 4;
-        case 0x3D: DEC_R8(R8::A); return 4;
-        case 0x3E: LD_R8_IMM8(R8::A, loadImm8()); return 8;
-        case 0x3F: CCF(); return 4;
-        default:
-            assert(false && "Opcode should not have been assigned to block 0");
-            return 0;
-    }
+    static void* const labels[256] = { OPCODES_256(OPCODE_LABEL_ADDRESS) };
+
+    uint16_t operand = fetchOperand(OPCODE_LENGTHS[opcode]);
+    goto *labels[opcode];
+    OPCODES_256(OPCODE_LABEL)
 }
-int CPU::executeBlock1(uint8_t opcode) {
-    // Halt
-    if (opcode == 0x76) {
-        // TODO handle halt bug
-        halted = true;
-        return 4;
-    }
 
-    // LD r8, r8
-    R8 src = getR8(opcode & 0b111);
-    R8 dst = getR8((opcode >> 3) & 0b111);
+#undef OPCODE_LABEL
+#undef OPCODE_LABEL_ADDRESS
+#undef OPCODES_256
+#undef OPCODES_16
 
-    uint8_t srcValue = getR8Value(src);
-    setR8Value(dst, srcValue);
+#else
 
-    if (src == R8::HL_ADDR || dst == R8::HL_ADDR) {
-        return 8;
-    } else {
-        return 4;
-    }
-}
-int CPU::executeBlock2(uint8_t opcode) {
-    uint8_t operationIdx = (opcode >> 3) & 0b111;
-    uint8_t registerIdx = opcode & 0b111;
-
-    R8 r8 = getR8(registerIdx);
-    uint8_t r8Value = getR8Value(r8);
-
-    // OPERATION a, r8
-    switch (operationIdx) {
-        case 0x0: ADD(r8Value); break;
-        case 0x1: ADC(r8Value); break;
-        case 0x2: SUB(r8Value); break;
-        case 0x3: SBC(r8Value); break;
-        case 0x4: AND(r8Value); break;
-        case 0x5: XOR(r8Value); break;
-        case 0x6: OR(r8Value); break;
-        case 0x7: CP(r8Value); break;
-    }
-    if (r8 == R8::HL_ADDR) {
-        return 8;
-    } else {
-        return 4;
-    }
-}
-int CPU::executeBlock3(uint8_t opcode) {
-    switch (opcode) {
-        case 0xC0: RET_COND(COND::NZ); return evaluateCondition(COND::NZ) ? 20 : 8;
-        case 0xC1: POP_R16STK(R16STK::BC); return 12;
-        case 0xC2: JP_COND_IMM16(COND::NZ, loadImm16()); return evaluateCondition(COND::NZ) ? 16 : 12;
-        case 0xC3: JP_IMM16(loadImm16()); return 16;
-        case 0xC4: CALL_COND_IMM16(COND::NZ, loadImm16()); return evaluateCondition(COND::NZ) ? 24 : 12;
-        case 0xC5: PUSH_R16STK(R16STK::BC); return 16;
-        case 0xC6: ADD(loadImm8()); return 8;
-        case 0xC7: RST_TGT3(0x00); return 16;
-        case 0xC8: RET_COND(COND::Z); return evaluateCondition(COND::Z) ? 20 : 8;
-        case 0xC9: RET(); return 16;
-        case 0xCA: JP_COND_IMM16(COND::Z, loadImm16()); return evaluateCondition(COND::Z) ? 16 : 12;
-        case 0xCB: assert(false && "Should have been handled by CB block"); return 0;
-        case 0xCC: CALL_COND_IMM16(COND::Z, loadImm16()); return evaluateCondition(COND::Z) ? 24 : 12;
-        case 0xCD: CALL_IMM16(loadImm16()); return 24;
-        case 0xCE: ADC(loadImm8()); return 8;
-        case 0xCF: RST_TGT3(0x08); return 16;
-        case 0xD0: RET_COND(COND::NC); return evaluateCondition(COND::NC) ? 20 : 8;
-        case 0xD1: POP_R16STK(R16STK::DE); return 12;
-        case 0xD2: JP_COND_IMM16(COND::NC, loadImm16()); return evaluateCondition(COND::NC) ? 16 : 12;
-        case 0xD4: CALL_COND_IMM16(COND::NC, loadImm16()); return evaluateCondition(COND::NC) ? 24 : 12;
-        case 0xD5: PUSH_R16STK(R16STK::DE); return 16;
-        case 0xD6: SUB(loadImm8()); return 8;
-        case 0xD7: RST_TGT3(0x10); return 16;
-        case 0xD8: RET_COND(COND::C); return evaluateCondition(COND::C) ? 20 : 8;
-        case 0xD9: RETI(); return 16;
-        case 0xDA: JP_COND_IMM16(COND::C, loadImm16()); return evaluateCondition(COND::C) ? 16 : 12;
-        case 0xDC: CALL_COND_IMM16(COND::C, loadImm16()); return evaluateCondition(COND::C) ? 24 : 12;
-        case 0xDE: SBC(loadImm8()); return 8;
-        case 0xDF: RST_TGT3(0x18); return 16;
-        case 0xE0: LDH_IMM8MEM_A(loadImm8()); return 12;
-        case 0xE1: POP_R16STK(R16STK::HL); return 12;
-        case 0xE2: LDH_CMEM_A(); return 8;
-        case 0xE5: PUSH_R16STK(R16STK::HL); return 16;
-        case 0xE6: AND(loadImm8()); return 8;
-        case 0xE7: RST_TGT3(0x20); return 16;
-        case 0xE8: ADD_SP_E8(loadE8()); return 16;
-        case 0xE9: JP_HL(); return 4;
-        case 0xEA: LD_IMM16MEM_A(loadImm16()); return 16;
-        case 0xEE: XOR(loadImm8()); return 8;
-        case 0xEF: RST_TGT3(0x28); return 16;
-        case 0xF0: LDH_A_IMM8MEM(loadImm8()); return 12;
-        case 0xF1: POP_R16STK(R16STK::AF); return 12;
-        case 0xF2: LDH_A_CMEM(); return 8;
-        case 0xF3: DI(); return 4;
-        case 0xF5: PUSH_R16STK(R16STK::AF); return 16;
-        case 0xF6: OR(loadImm8()); return 8;
-        case 0xF7: RST_TGT3(0x30); return 16;
-        case 0xF8: LD_HL_SP_PLUS_E8(loadE8()); return 12;
-        case 0xF9: LD_SP_HL(); return 8;
-        case 0xFA: LD_A_IMM16MEM(loadImm16()); return 16;
-        case 0xFB: EI(); return 4;
-        case 0xFE: CP(loadImm8()); return 8;
-        case 0xFF: RST_TGT3(0x38); return 16;
-        default:
-            assert(false && "Invalid opcode in block 3");
-            return 0;
-    }
+int CPU::executeInstruction(uint8_t opcode) {
+    uint16_t operand = fetchOperand(OPCODE_LENGTHS[opcode]);
+    return (this->*OPCODE_TABLE[opcode])(operand);
 }
-int CPU::executeBlockCB(uint8_t opcode) {
-    uint8_t registerIdx = opcode & 0b111;
-    R8 targetRegister = getR8(registerIdx);
-
-    uint8_t bitIdx = (opcode >> 3) & 0b111;
-    switch (opcode >> 6) {
-        case 0: // Rotates and Shifts
-            switch (opcode >> 3) {
-                case 0: RLC(targetRegister); break;
-                case 1: RRC(targetRegister); break;
-                case 2: RL(targetRegister); break;
-                case 3: RR(targetRegister); break;
-                case 4: SLA(targetRegister); break;
-                case 5: SRA(targetRegister); break;
-                case 6: SWAP(targetRegister); break;
-                case 7: SRL(targetRegister); break;
-            } break;
-        case 1: BIT(bitIdx, targetRegister); break;
-        case 2: RES(bitIdx, targetRegister); break;
-        case 3: SET(bitIdx, targetRegister); break;
-    }
 
-    if (targetRegister == R8::HL_ADDR) {
-        if ((opcode >> 6) == 1) { // BIT
-            return 12;
-        } else {
-            return 16;
-        }
-    } else {
-        return 8;
-    }
-}
+#endif
 
 // Block 0
 void CPU::NOOP() {
@@ -1085,10 +1196,44 @@ void CPU::SET(uint8_t n, R8 reg) {
     setR8Value(reg, result);
 }
 
+CPU::CPU(MMU& bus): bus(bus) {
+#ifdef GAMEBOY_JIT
+    jit = std::make_unique<JitCompiler>(*this);
+    jitEnabled = jit->isAvailable();
+#endif
+}
+
+CPU::~CPU() = default;
+
+void CPU::setJitEnabled(bool enabled) {
+#ifdef GAMEBOY_JIT
+    jitEnabled = enabled && jit->isAvailable();
+#endif
+}
+
+void CPU::saveState(StateWriter& state) const {
+    state.write(registers);
+    state.write(PC);
+    state.write(SP);
+    state.write(halted);
+    state.write(interruptsEnabled);
+    state.write(enableInterruptsNextInstruction);
+}
+
+void CPU::loadState(StateReader& state) {
+    state.read(registers);
+    state.read(PC);
+    state.read(SP);
+    state.read(halted);
+    state.read(interruptsEnabled);
+    state.read(enableInterruptsNextInstruction);
+    currentBlock = nullptr;
+}
+
 void CPU::run() {
     // Main CPU loop
     while (true) {
-        cycle();
+        cycle(1);
     }
 }
 
@@ -0,0 +1,25 @@
+#include "display.hpp"
+
+Display::Display() {
+    SDL_Init(SDL_INIT_VIDEO);
+    window = SDL_CreateWindow("Gameboy", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+Display::~Display() {
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+void Display::present(const FrameBuffer& buffer) {
+    SDL_UpdateTexture(texture, NULL, buffer.data(), SCREEN_WIDTH * 4);
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+}
+
+void Display::setTitle(const char* title) {
+    SDL_SetWindowTitle(window, title);
+}
@@ -0,0 +1,47 @@
+#include "frame_pacer.hpp"
+
+#include <algorithm>
+#include <thread>
+
+FramePacer::FramePacer(double framesPerSecond) :
+    framesPerSecond(framesPerSecond), nextFrame(Clock::now()), measureStart(nextFrame) {}
+
+void FramePacer::setSpeed(double multiplier) {
+    speed.store(std::clamp(multiplier, MIN_SPEED, MAX_SPEED), std::memory_order_relaxed);
+}
+
+void FramePacer::updateMeasurement(Clock::time_point now) {
+    framesMeasured++;
+    std::chrono::duration<double> elapsed = now - measureStart;
+    if (elapsed < MEASURE_INTERVAL) {
+        return;
+    }
+    measuredSpeed.store(framesMeasured / elapsed.count() / framesPerSecond, std::memory_order_relaxed);
+    framesMeasured = 0;
+    measureStart = now;
+}
+
+void FramePacer::waitForNextFrame() {
+    Clock::time_point now = Clock::now();
+    updateMeasurement(now);
+
+    if (!isThrottled() || isFastForward()) {
+        nextFrame = now;
+        return;
+    }
+
+    // Deadlines are kept absolute so rounding in one frame doesn't add up over many
+    std::chrono::duration<double> frameTime(1.0 / (framesPerSecond * getSpeed()));
+    nextFrame += std::chrono::duration_cast<Clock::duration>(frameTime);
+    if (now - nextFrame > MAX_LAG) {
+        nextFrame = now;
+        return;
+    }
+
+    if (nextFrame - now > SPIN_TIME) {
+        std::this_thread::sleep_until(nextFrame - SPIN_TIME);
+    }
+    while (Clock::now() < nextFrame) {
+        std::this_thread::yield();
+    }
+}
@@ -1,44 +1,119 @@
 #include "gameboy.hpp"
 
-Gameboy::Gameboy(Cartridge& cartridge) : cartridge(cartridge), mmu(cartridge), cpu(mmu), ppu(mmu) {}
-
-void Gameboy::run() {
-    // Main emulation loop
-    bool quit = false;
-    SDL_Event event;
-
-    while (!quit) {
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) {
-                quit = true;
-            } else if (event.type == SDL_KEYDOWN) {
-                switch (event.key.keysym.sym) {
-                    case SDLK_RIGHT: mmu.handleKeyDown(0); break;
-                    case SDLK_LEFT: mmu.handleKeyDown(1); break;
-                    case SDLK_UP: mmu.handleKeyDown(2); break;
-                    case SDLK_DOWN: mmu.handleKeyDown(3); break;
-                    case SDLK_z: mmu.handleKeyDown(4); break; // A button
-                    case SDLK_x: mmu.handleKeyDown(5); break; // B button
-                    case SDLK_SPACE: mmu.handleKeyDown(6); break; // Select button
-                    case SDLK_RETURN: mmu.handleKeyDown(7); break; // Start button
-                    default: break;
-                }
-            } else if (event.type == SDL_KEYUP) {
-                switch (event.key.keysym.sym) {
-                    case SDLK_RIGHT: mmu.handleKeyUp(0); break;
-                    case SDLK_LEFT: mmu.handleKeyUp(1); break;
-                    case SDLK_UP: mmu.handleKeyUp(2); break;
-                    case SDLK_DOWN: mmu.handleKeyUp(3); break;
-                    case SDLK_z: mmu.handleKeyUp(4); break;
-                    case SDLK_x: mmu.handleKeyUp(5); break;
-                    case SDLK_SPACE: mmu.handleKeyUp(6); break;
-                    case SDLK_RETURN: mmu.handleKeyUp(7); break;
-                    default: break;
-                }
-            }
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+    constexpr char SAVE_STATE_MAGIC[4] = {'G', 'B', 'S', 'S'};
+}
+
+Gameboy::Gameboy(Cartridge& cartridge, FrameSink& frameSink) :
+    cartridge(cartridge), mmu(cartridge, scheduler), cpu(mmu), ppu(mmu, frameSink, scheduler) {
+    cartridge.setClock(&scheduler);
+
+    std::vector<uint8_t> state;
+    saveState(state);
+    stateSize = state.size();
+}
+
+void Gameboy::runEvents() {
+    while (scheduler.eventDue()) {
+        Event event = scheduler.popEvent();
+        switch (event.type) {
+            case EventType::PPU_MODE:
+                ppu.handleModeEvent(event.time);
+                break;
+            case EventType::LCD_REGISTER_WRITE:
+                ppu.handleRegisterWrite(event.time);
+                break;
+            case EventType::TIMER:
+                mmu.handleTimerEvent(event.time);
+                break;
+            case EventType::OAM_DMA:
+                mmu.handleOamDmaEvent();
+                break;
+            case EventType::COUNT:
+                break;
+        }
+    }
+}
+
+int Gameboy::step() {
+    int cycles = cpu.cycle(1);
+    scheduler.advance(cycles);
+    runEvents();
+    return cycles;
+}
+
+void Gameboy::runFrame() {
+    frameEnd += CYCLES_PER_FRAME;
+
+    while (scheduler.getCurrentCycle() < frameEnd) {
+        // The CPU runs freely until the next event. Register writes can bring that
+        // event forward, so the deadline is re-read after every instruction
+        uint64_t now = scheduler.getCurrentCycle();
+        while (now < scheduler.getNextDeadline() && now < frameEnd) {
+            uint64_t deadline = std::min(scheduler.getNextDeadline(), frameEnd);
+            scheduler.advance(cpu.cycle(static_cast<int>(deadline - now)));
+            now = scheduler.getCurrentCycle();
         }
-        int cycles = cpu.cycle();
-        ppu.tick(cycles);
-        mmu.tick(cycles);
+        runEvents();
+    }
+}
+
+void Gameboy::saveState(std::vector<uint8_t>& out, size_t* memoryOffset) const {
+    StateWriter state(out);
+    state.write(SAVE_STATE_MAGIC);
+    state.write(SAVE_STATE_VERSION);
+    state.write(cartridge.getChecksum());
+
+    state.write(frameEnd);
+    scheduler.saveState(state);
+    cpu.saveState(state);
+    cartridge.saveState(state);
+    if (memoryOffset) {
+        *memoryOffset = out.size();
+    }
+    mmu.saveState(state);
+    ppu.saveState(state);
+}
+
+void Gameboy::loadState(const uint8_t* data, size_t size) {
+    StateReader state(data, size);
+    char magic[4];
+    uint32_t version;
+    uint32_t checksum;
+    state.read(magic);
+    state.read(version);
+    state.read(checksum);
+    if (std::memcmp(magic, SAVE_STATE_MAGIC, sizeof(magic)) != 0) {
+        throw std::runtime_error("Not a save state");
+    }
+    if (version != SAVE_STATE_VERSION) {
+        throw std::runtime_error("Unsupported save state version " + std::to_string(version));
     }
-}
\ No newline at end of file
+    if (checksum != cartridge.getChecksum()) {
+        throw std::runtime_error("Save state is for a different ROM");
+    }
+    // Checking the size up front means a bad state can't leave the machine half loaded
+    if (size != stateSize) {
+        throw std::runtime_error("Save state has the wrong size");
+    }
+
+    // The cartridge goes before the MMU, which maps its banks
+    state.read(frameEnd);
+    scheduler.loadState(state);
+    cpu.loadState(state);
+    cartridge.loadState(state);
+    mmu.loadState(state);
+    ppu.loadState(state);
+}
+
+void Gameboy::handleKeyDown(uint8_t key) {
+    mmu.handleKeyDown(key);
+}
+
+void Gameboy::handleKeyUp(uint8_t key) {
+    mmu.handleKeyUp(key);
+}
@@ -0,0 +1,70 @@
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "cartridge.hpp"
+#include "frame_sink.hpp"
+#include "gameboy.hpp"
+
+// Runs a ROM for a fixed number of frames as fast as possible and reports throughput
+int main(int argc, char* argv[]) {
+    const char* usage = "Usage: ./gameboy_headless {filename} [frames] [--serial] [--fifo] [--turbo {n}]\n";
+    if (argc < 2) {
+        std::cout << "Invalid Input. " << usage;
+        return 0;
+    }
+
+    std::string fileName = argv[1];
+    long numFrames = 3600;
+    bool printSerial = false;
+    bool pixelFifo = false;
+    int turboFrameSkip = 1;
+    try {
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--serial") {
+                printSerial = true;
+            } else if (arg == "--fifo") {
+                pixelFifo = true;
+            } else if (arg == "--turbo" && i + 1 < argc) {
+                turboFrameSkip = std::stoi(argv[++i]);
+            } else {
+                numFrames = std::stol(arg);
+            }
+        }
+    } catch (const std::logic_error&) {
+        // std::stoi and std::stol throw invalid_argument or out_of_range on a bad number
+        std::cout << "Invalid number. " << usage;
+        return 1;
+    }
+
+    Cartridge cartridge(fileName);
+    CountingFrameSink sink;
+    Gameboy emu(cartridge, sink);
+    if (pixelFifo) {
+        emu.setRenderer(PPU_RENDERER::PIXEL_FIFO);
+    }
+    if (turboFrameSkip > 1) {
+        emu.setTurbo(true, turboFrameSkip);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < numFrames; i++) {
+        emu.runFrame();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double framesPerSecond = numFrames / seconds;
+    std::cout << "Ran " << numFrames << " frames (" << sink.frames << " presented) in "
+              << seconds << " s" << std::endl;
+    std::cout << framesPerSecond << " frames/sec ("
+              << framesPerSecond / Gameboy::FRAME_RATE << "x real time)" << std::endl;
+
+    // Test ROMs such as Blargg's report their results over the serial port
+    if (printSerial) {
+        std::cout << "Serial output:" << std::endl << emu.getSerialOutput() << std::endl;
+    }
+    return 0;
+}
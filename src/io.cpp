@@ -1,9 +1,18 @@
 #include "io.hpp"
 
+IO::IO(Scheduler& scheduler) : scheduler(scheduler) {}
+
 uint8_t IO::read(uint16_t address) {
     switch (address) {
         case IO::DIV_ADDRESS:
-            return io.at(IO::DIV_ADDRESS - IO::IO_START);
+            // DIV is the upper byte of a counter running at the CPU clock
+            return static_cast<uint8_t>((scheduler.getCurrentCycle() - divResetCycle) >> 8);
+        case IO::TIMA_ADDRESS:
+            updateTima();
+            return io.at(IO::TIMA_ADDRESS - IO::IO_START);
+        case IO::KEY1_ADDRESS:
+            // Not there on the DMG - software checks for 0xFF before switching speed
+            return 0xFF;
         case 0xFF00: // Joypad register
             {
                 uint8_t joypad_state = io.at(address - IO::IO_START);
@@ -27,7 +36,43 @@ uint8_t IO::read(uint16_t address) {
 void IO::write(uint16_t address, uint8_t val) {
     switch (address) {
         case IO::DIV_ADDRESS:
-            io.at(IO::DIV_ADDRESS - IO::IO_START) = 0;
+            divResetCycle = scheduler.getCurrentCycle();
+            break;
+        case IO::TIMA_ADDRESS:
+        case IO::TAC_ADDRESS:
+            // Catch up with the old settings before they change
+            updateTima();
+            io.at(address - IO::IO_START) = val;
+            if (address == IO::TAC_ADDRESS) {
+                timaPhase %= getTimaPeriod();
+            }
+            scheduleTimaOverflow();
+            break;
+        case IO::LCDC_ADDRESS:
+            logRenderRegisterWrite(address, val);
+            io.at(address - IO::IO_START) = val;
+            scheduler.scheduleIn(EventType::LCD_REGISTER_WRITE, 0);
+            break;
+        case IO::LYC_ADDRESS:
+            io.at(address - IO::IO_START) = val;
+            scheduler.scheduleIn(EventType::LCD_REGISTER_WRITE, 0);
+            break;
+        case IO::SCY_ADDRESS:
+        case IO::SCX_ADDRESS:
+        case IO::BGP_ADDRESS:
+        case IO::OBP0_ADDRESS:
+        case IO::OBP1_ADDRESS:
+        case IO::WY_ADDRESS:
+        case IO::WX_ADDRESS:
+            logRenderRegisterWrite(address, val);
+            io.at(address - IO::IO_START) = val;
+            break;
+        case IO::SC_ADDRESS:
+            // Transfer start with the internal clock
+            if ((val & 0x81) == 0x81) {
+                serialOutput.push_back(static_cast<char>(io.at(IO::SB_ADDRESS - IO::IO_START)));
+            }
+            io.at(address - IO::IO_START) = val;
             break;
         case 0xFF00: // Joypad register
             // Only bits 4 and 5 are writable (selection bits)
@@ -39,35 +84,72 @@ void IO::write(uint16_t address, uint8_t val) {
     }
 }
 
-void IO::tick(int cycles) {
-    IO::divCounter += cycles;
-    if (IO::divCounter >= 256) {
-        IO::divCounter -= 256;
-        io.at(IO::DIV_ADDRESS - IO::IO_START)++;
+void IO::logRenderRegisterWrite(uint16_t address, uint8_t val) {
+    if (renderRegisterLog.enabled) {
+        renderRegisterLog.writes.push_back({scheduler.getCurrentCycle(), address, val});
     }
+}
 
-    if (io.at(IO::TAC_ADDRESS - IO::IO_START) & 0x4) {
-        IO::timaCounter += cycles;
-        int threshold;
-        switch (io.at(IO::TAC_ADDRESS - IO::IO_START) & 0x3) {
-            case 0: threshold = 1024; break;
-            case 1: threshold = 16; break;
-            case 2: threshold = 64; break;
-            case 3: threshold = 256; break;
-        }
-
-        if (IO::timaCounter >= threshold) {
-            IO::timaCounter -= threshold;
-            if (io.at(IO::TIMA_ADDRESS - IO::IO_START) == 0xFF) {
-                io.at(IO::TIMA_ADDRESS - IO::IO_START) = io.at(IO::TMA_ADDRESS - IO::IO_START);
-                requestInterrupt(0x04); // Timer interrupt
-            } else {
-                io.at(IO::TIMA_ADDRESS - IO::IO_START)++;
-            }
-        }
+int IO::getTimaPeriod() {
+    switch (io.at(IO::TAC_ADDRESS - IO::IO_START) & 0x3) {
+        case 0: return 1024;
+        case 1: return 16;
+        case 2: return 64;
+        default: return 256;
     }
 }
 
+bool IO::isTimaEnabled() {
+    return io.at(IO::TAC_ADDRESS - IO::IO_START) & 0x4;
+}
+
+void IO::updateTima() {
+    uint64_t now = scheduler.getCurrentCycle();
+    if (isTimaEnabled()) {
+        // Never wraps - the overflow event fires before TIMA could pass 0xFF
+        uint64_t elapsed = timaPhase + (now - lastTimaUpdate);
+        int period = getTimaPeriod();
+        io.at(IO::TIMA_ADDRESS - IO::IO_START) += static_cast<uint8_t>(elapsed / period);
+        timaPhase = static_cast<int>(elapsed % period);
+    }
+    lastTimaUpdate = now;
+}
+
+void IO::scheduleTimaOverflow() {
+    if (!isTimaEnabled()) {
+        scheduler.cancel(EventType::TIMER);
+        return;
+    }
+
+    uint64_t increments = 0x100 - io.at(IO::TIMA_ADDRESS - IO::IO_START);
+    uint64_t cyclesUntilOverflow = increments * getTimaPeriod() - timaPhase;
+    scheduler.scheduleAt(EventType::TIMER, lastTimaUpdate + cyclesUntilOverflow);
+}
+
+void IO::handleTimerEvent(uint64_t time) {
+    // TIMA overflowed exactly at time, later reads count on from there
+    io.at(IO::TIMA_ADDRESS - IO::IO_START) = io.at(IO::TMA_ADDRESS - IO::IO_START);
+    timaPhase = 0;
+    lastTimaUpdate = time;
+    requestInterrupt(0x04); // Timer interrupt
+    scheduleTimaOverflow();
+}
+
+void IO::saveState(StateWriter& state) const {
+    state.write(io);
+    state.write(divResetCycle);
+    state.write(lastTimaUpdate);
+    state.write(timaPhase);
+}
+
+void IO::loadState(StateReader& state) {
+    state.read(io);
+    state.read(divResetCycle);
+    state.read(lastTimaUpdate);
+    state.read(timaPhase);
+    renderRegisterLog.writes.clear();
+}
+
 void IO::requestInterrupt(uint8_t interrupt) {
     io.at(0xFF0F - IO::IO_START) |= interrupt;
 }
@@ -0,0 +1,276 @@
+#include "jit.hpp"
+
+#ifdef GAMEBOY_JIT
+
+#include <cstring>
+#include <sys/mman.h>
+
+// Register usage inside compiled blocks (all callee saved):
+//   rbx - CPU*                   r12d - cycles taken so far
+//   r13d - cycle budget          r14d - MMU write version on entry
+//   r15 - pointer to the MMU write version
+//   rbp - pointer to the scheduler's current cycle, which is r12d ahead during handler
+//         calls and back at the block's start time otherwise
+
+JitCompiler::JitCompiler(CPU& cpu) : cpu(cpu) {
+    void* memory = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory != MAP_FAILED) {
+        codeBuffer = static_cast<uint8_t*>(memory);
+    }
+
+    auto offsetOf = [&cpu](const void* member) {
+        return static_cast<int32_t>(static_cast<const uint8_t*>(member) - reinterpret_cast<const uint8_t*>(&cpu));
+    };
+    pcOffset = offsetOf(&cpu.PC);
+    spOffset = offsetOf(&cpu.SP);
+    instructionCountOffset = offsetOf(&cpu.instructionCount);
+    registerOffsets[static_cast<int>(R8::A)] = offsetOf(&cpu.registers.A);
+    registerOffsets[static_cast<int>(R8::F)] = offsetOf(&cpu.registers.F);
+    registerOffsets[static_cast<int>(R8::B)] = offsetOf(&cpu.registers.B);
+    registerOffsets[static_cast<int>(R8::C)] = offsetOf(&cpu.registers.C);
+    registerOffsets[static_cast<int>(R8::D)] = offsetOf(&cpu.registers.D);
+    registerOffsets[static_cast<int>(R8::E)] = offsetOf(&cpu.registers.E);
+    registerOffsets[static_cast<int>(R8::H)] = offsetOf(&cpu.registers.H);
+    registerOffsets[static_cast<int>(R8::L)] = offsetOf(&cpu.registers.L);
+    registerOffsets[static_cast<int>(R8::HL_ADDR)] = 0; // Never used - [HL] goes through handlers
+}
+
+JitCompiler::~JitCompiler() {
+    if (codeBuffer) {
+        munmap(codeBuffer, CODE_BUFFER_SIZE);
+    }
+}
+
+bool JitCompiler::hasSpace(size_t numInstructions) const {
+    // Prologue, epilogue and the final exit take well under one instruction's worth
+    return codeUsed + (numInstructions + 2) * MAX_INSTRUCTION_CODE_SIZE <= CODE_BUFFER_SIZE;
+}
+
+void JitCompiler::reset() {
+    codeUsed = 0;
+}
+
+void JitCompiler::emit8(uint8_t value) {
+    *cursor++ = value;
+}
+void JitCompiler::emit16(uint16_t value) {
+    std::memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
+}
+void JitCompiler::emit32(uint32_t value) {
+    std::memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
+}
+void JitCompiler::emit64(uint64_t value) {
+    std::memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
+}
+
+void JitCompiler::emitJump(uint8_t opcode, const uint8_t* target) {
+    // jmp rel32
+    emit8(opcode);
+    emit32(static_cast<uint32_t>(target - (cursor + 4)));
+}
+
+void JitCompiler::emitJumpIfNotEqual(const uint8_t* target) {
+    // jne rel32
+    emit8(0x0F);
+    emitJump(0x85, target);
+}
+
+void JitCompiler::emitStorePC(uint16_t value) {
+    // mov word [rbx + PC], imm16
+    emit8(0x66); emit8(0xC7); emit8(0x83);
+    emit32(pcOffset);
+    emit16(value);
+}
+
+void JitCompiler::emitEpilogue() {
+    emit8(0x44); emit8(0x89); emit8(0xE0); // mov eax, r12d
+    emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08); // add rsp, 8
+    emit8(0x5D);                           // pop rbp
+    emit8(0x41); emit8(0x5F);              // pop r15
+    emit8(0x41); emit8(0x5E);              // pop r14
+    emit8(0x41); emit8(0x5D);              // pop r13
+    emit8(0x41); emit8(0x5C);              // pop r12
+    emit8(0x5B);                           // pop rbx
+    emit8(0xC3);                           // ret
+}
+
+// Translates the instructions that only touch CPU registers, returns false if the
+// opcode has to go through its handler instead
+bool JitCompiler::emitNative(uint8_t opcode, uint16_t operand) {
+    int cycles;
+
+    if (opcode == 0x00) {
+        // NOP
+        cycles = 4;
+    } else if (opcode >= 0x40 && opcode < 0x80 && opcode != 0x76) {
+        // LD r8, r8
+        R8 dst = CPU::getR8((opcode >> 3) & 0b111);
+        R8 src = CPU::getR8(opcode & 0b111);
+        if (dst == R8::HL_ADDR || src == R8::HL_ADDR) {
+            return false;
+        }
+        emit8(0x0F); emit8(0xB6); emit8(0x83); // movzx eax, byte [rbx + src]
+        emit32(registerOffsets[static_cast<int>(src)]);
+        emit8(0x88); emit8(0x83);              // mov byte [rbx + dst], al
+        emit32(registerOffsets[static_cast<int>(dst)]);
+        cycles = 4;
+    } else if ((opcode & 0xC7) == 0x06 && opcode != 0x36) {
+        // LD r8, imm8
+        R8 dst = CPU::getR8((opcode >> 3) & 0b111);
+        emit8(0xC6); emit8(0x83);              // mov byte [rbx + dst], imm8
+        emit32(registerOffsets[static_cast<int>(dst)]);
+        emit8(static_cast<uint8_t>(operand));
+        cycles = 8;
+    } else if ((opcode & 0xCF) == 0x01 || (opcode & 0xC7) == 0x03) {
+        // LD r16, imm16 / INC r16 / DEC r16
+        R16 r16 = CPU::getR16((opcode >> 4) & 0b11);
+        bool isLoad = (opcode & 0x0F) == 0x01;
+        bool isIncrement = (opcode & 0x0F) == 0x03;
+
+        if (r16 == R16::SP) {
+            if (isLoad) {
+                emit8(0x66); emit8(0xC7); emit8(0x83); // mov word [rbx + SP], imm16
+                emit32(spOffset);
+                emit16(operand);
+            } else {
+                emit8(0x66); emit8(0xFF);              // inc/dec word [rbx + SP]
+                emit8(isIncrement ? 0x83 : 0x8B);
+                emit32(spOffset);
+            }
+        } else {
+            R8 high = (r16 == R16::BC) ? R8::B : (r16 == R16::DE) ? R8::D : R8::H;
+            R8 low = (r16 == R16::BC) ? R8::C : (r16 == R16::DE) ? R8::E : R8::L;
+            int32_t highOffset = registerOffsets[static_cast<int>(high)];
+            int32_t lowOffset = registerOffsets[static_cast<int>(low)];
+
+            if (isLoad) {
+                emit8(0xC6); emit8(0x83);              // mov byte [rbx + high], imm8
+                emit32(highOffset);
+                emit8(static_cast<uint8_t>(operand >> 8));
+                emit8(0xC6); emit8(0x83);              // mov byte [rbx + low], imm8
+                emit32(lowOffset);
+                emit8(static_cast<uint8_t>(operand & 0xFF));
+            } else if (lowOffset == highOffset + 1) {
+                // The pair is stored high byte first, so swap it around the increment
+                emit8(0x0F); emit8(0xB7); emit8(0x83); // movzx eax, word [rbx + high]
+                emit32(highOffset);
+                emit8(0x66); emit8(0xC1); emit8(0xC0); emit8(0x08); // rol ax, 8
+                emit8(0xFF); emit8(isIncrement ? 0xC0 : 0xC8);      // inc/dec eax
+                emit8(0x66); emit8(0xC1); emit8(0xC0); emit8(0x08); // rol ax, 8
+                emit8(0x66); emit8(0x89); emit8(0x83); // mov word [rbx + high], ax
+                emit32(highOffset);
+            } else {
+                return false;
+            }
+        }
+        cycles = isLoad ? 12 : 8;
+    } else {
+        return false;
+    }
+
+    emit8(0x41); emit8(0x83); emit8(0xC4); // add r12d, imm8
+    emit8(static_cast<uint8_t>(cycles));
+    return true;
+}
+
+JitFunction JitCompiler::compile(uint16_t startPC, const CPU::DecodedBlock& block) {
+    if (!codeBuffer || !hasSpace(block.instructions.size())) {
+        return nullptr;
+    }
+
+    cursor = codeBuffer + codeUsed;
+
+    // Every exit jumps back to the epilogue, so it goes first
+    epilogue = cursor;
+    emitEpilogue();
+
+    uint8_t* entry = cursor;
+    emit8(0x53);                           // push rbx
+    emit8(0x41); emit8(0x54);              // push r12
+    emit8(0x41); emit8(0x55);              // push r13
+    emit8(0x41); emit8(0x56);              // push r14
+    emit8(0x41); emit8(0x57);              // push r15
+    emit8(0x55);                           // push rbp
+    emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08); // sub rsp, 8 to keep calls aligned
+    emit8(0x48); emit8(0x89); emit8(0xFB); // mov rbx, rdi
+    emit8(0x41); emit8(0x89); emit8(0xF5); // mov r13d, esi
+    emit8(0x45); emit8(0x31); emit8(0xE4); // xor r12d, r12d
+    emit8(0x49); emit8(0xBF);              // mov r15, imm64
+    emit64(reinterpret_cast<uint64_t>(cpu.bus.getWriteVersionPointer()));
+    emit8(0x45); emit8(0x8B); emit8(0x37); // mov r14d, [r15]
+    emit8(0x48); emit8(0xBD);              // mov rbp, imm64
+    emit64(reinterpret_cast<uint64_t>(cpu.bus.getScheduler().getCurrentCyclePointer()));
+
+    uint16_t pc = startPC;
+    bool exited = false;
+    for (const CPU::DecodedInstruction& instruction : block.instructions) {
+        pc = static_cast<uint16_t>(pc + instruction.length);
+
+        emit8(0x48); emit8(0x83); emit8(0x83); // add qword [rbx + instructionCount], 1
+        emit32(instructionCountOffset);
+        emit8(0x01);
+
+        if (emitNative(instruction.opcode, instruction.operand)) {
+            // Stop at the budget like the interpreter would between instructions
+            emit8(0x45); emit8(0x39); emit8(0xEC); // cmp r12d, r13d
+            emit8(0x7C); emit8(14);                // jl over the exit
+            emitStorePC(pc);                       // 9 bytes
+            emitJump(0xE9, epilogue);              // 5 bytes
+            continue;
+        }
+
+        // Handlers expect PC to already point past the instruction
+        emitStorePC(pc);
+        emit8(0x48); emit8(0x89); emit8(0xDF); // mov rdi, rbx
+        emit8(0xBE);                           // mov esi, imm32
+        emit32(instruction.operand);
+        emit8(0x48); emit8(0xB8);              // mov rax, imm64
+        auto thunk = (instruction.opcode == 0xCB) ?
+            CPU::CB_THUNKS[instruction.operand] :
+            CPU::OPCODE_THUNKS[instruction.opcode];
+        emit64(reinterpret_cast<uint64_t>(thunk));
+        // Timers, DMA and the PPU read the clock, so it has to be where the
+        // interpreter would have it for this instruction
+        emit8(0x44); emit8(0x89); emit8(0xE1); // mov ecx, r12d
+        emit8(0x48); emit8(0x01); emit8(0x4D); emit8(0x00); // add [rbp], rcx
+        emit8(0xFF); emit8(0xD0);              // call rax
+        emit8(0x44); emit8(0x89); emit8(0xE1); // mov ecx, r12d
+        emit8(0x48); emit8(0x29); emit8(0x4D); emit8(0x00); // sub [rbp], rcx
+        emit8(0x41); emit8(0x01); emit8(0xC4); // add r12d, eax
+
+        if (CPU::endsBlock(instruction.opcode) || instruction.opcode == 0xFB) {
+            // Control flow, HALT or EI (interrupts need checking before the next instruction)
+            emitJump(0xE9, epilogue);
+            exited = true;
+            break;
+        }
+
+        // A branch was taken
+        emit8(0x66); emit8(0x81); emit8(0xBB); // cmp word [rbx + PC], imm16
+        emit32(pcOffset);
+        emit16(pc);
+        emitJumpIfNotEqual(epilogue);
+
+        // The instruction wrote to IO or an MBC register
+        emit8(0x45); emit8(0x39); emit8(0x37); // cmp [r15], r14d
+        emitJumpIfNotEqual(epilogue);
+
+        emit8(0x45); emit8(0x39); emit8(0xEC); // cmp r12d, r13d
+        emit8(0x0F);                           // jge epilogue
+        emitJump(0x8D, epilogue);
+    }
+
+    if (!exited) {
+        emitStorePC(pc);
+        emitJump(0xE9, epilogue);
+    }
+
+    codeUsed = cursor - codeBuffer;
+    return reinterpret_cast<JitFunction>(entry);
+}
+
+#endif
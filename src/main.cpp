@@ -3,65 +3,269 @@
 //
 
 #include <cartridge.hpp>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <thread>
 #include <vector>
 #include <iostream>
-#include <fstream>
+#include <stdexcept>
 
+#include "display.hpp"
+#include "frame_pacer.hpp"
 #include "gameboy.hpp"
+#include "rewind_buffer.hpp"
+#include "spsc_queue.hpp"
 
 using namespace std;
 
-vector<char> readFile(string fileName)
-{
-    ifstream file(fileName, ios::binary | ios::ate);
-
-    if (!file.is_open())
-    {
-        throw runtime_error("Failed to open file.");
+// Maps a keyboard key to the joypad button index used by the IO, or -1 if unmapped
+int getButtonIndex(SDL_Keycode key) {
+    switch (key) {
+        case SDLK_RIGHT: return 0;
+        case SDLK_LEFT: return 1;
+        case SDLK_UP: return 2;
+        case SDLK_DOWN: return 3;
+        case SDLK_z: return 4; // A button
+        case SDLK_x: return 5; // B button
+        case SDLK_SPACE: return 6; // Select button
+        case SDLK_RETURN: return 7; // Start button
+        default: return -1;
     }
+}
+
+// A joypad button or the turbo or rewind key going down or up, or a save state request,
+// passed from the SDL thread to the emulation thread
+struct InputEvent {
+    enum class Type : uint8_t {
+        BUTTON,
+        TURBO,
+        REWIND,
+        SAVE_STATE,
+        LOAD_STATE
+    };
 
-    streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    Type type;
+    uint8_t button;
+    bool pressed;
+};
+using InputQueue = SpscQueue<InputEvent, 64>;
 
-    vector<char> buffer(size);
+void saveStateFile(const Gameboy& emu, const std::string& fileName) {
+    std::vector<uint8_t> state;
+    emu.saveState(state);
+    std::ofstream file(fileName, std::ios::binary);
+    if (!file.write(reinterpret_cast<const char*>(state.data()), state.size())) {
+        std::cerr << "Failed to write save state " << fileName << std::endl;
+    }
+}
 
-    if (!file.read(buffer.data(), size))
-    {
-        throw runtime_error("Failed to read file.");
+void loadStateFile(Gameboy& emu, const std::string& fileName) {
+    try {
+        std::vector<uint8_t> state = readRomFile(fileName);
+        emu.loadState(state.data(), state.size());
+    } catch (const std::exception& exception) {
+        std::cerr << "Failed to load save state " << fileName << ": " << exception.what() << std::endl;
     }
+}
+
+// Runs the emulator one frame at a time until quit is set, applying input between
+// frames. Finished frames go out through the Gameboy's FrameRing
+void runEmulation(Gameboy& emu, InputQueue& input, FramePacer& pacer, const std::atomic<bool>& quit,
+                  const std::string& stateFileName) {
+    // Every frame is kept - a few hundred bytes each for the games we tried
+    RewindBuffer rewindBuffer;
+    bool rewinding = false;
 
-    return buffer;
+    while (!quit.load(std::memory_order_relaxed)) {
+        InputEvent event;
+        while (input.pop(event)) {
+            if (event.type == InputEvent::Type::SAVE_STATE) {
+                saveStateFile(emu, stateFileName);
+            } else if (event.type == InputEvent::Type::LOAD_STATE) {
+                loadStateFile(emu, stateFileName);
+            } else if (event.type == InputEvent::Type::TURBO) {
+                // Skips rendering most frames and lifts the frame rate limit
+                emu.setTurbo(event.pressed);
+                pacer.setFastForward(event.pressed);
+            } else if (event.type == InputEvent::Type::REWIND) {
+                rewinding = event.pressed;
+            } else if (event.pressed) {
+                emu.handleKeyDown(event.button);
+            } else {
+                emu.handleKeyUp(event.button);
+            }
+        }
+
+        if (rewinding) {
+            // Step back a snapshot and run its frame to have something to show. Nothing is
+            // captured, so the next step goes back one further
+            rewindBuffer.rewind(emu);
+            emu.runFrame();
+        } else {
+            emu.runFrame();
+            rewindBuffer.captureFrame(emu);
+        }
+        pacer.waitForNextFrame();
+    }
 }
 
+// Speed changes on the keyboard, returns false for keys that aren't hotkeys
+bool handleHotkey(SDL_Keycode key, FramePacer& pacer) {
+    switch (key) {
+        case SDLK_EQUALS:
+            pacer.setSpeed(pacer.getSpeed() * 2);
+            return true;
+        case SDLK_MINUS:
+            pacer.setSpeed(pacer.getSpeed() / 2);
+            return true;
+        case SDLK_u:
+            pacer.setThrottled(!pacer.isThrottled());
+            return true;
+        default:
+            return false;
+    }
+}
 
-// TODO - move main loop into chip8 class
 int main(int argc, char* argv[])
 {
+    const char* usage = "Usage: ./gameboy {filename} [--test] [--speed {multiplier}] [--unthrottled] "
+                        "[--save-sync {seconds}]\n";
     bool isTestMode = false;
+    double speed = 1.0;
+    bool throttled = true;
+    // How often battery RAM is forced to disk - in between it is only in the page cache
+    uint32_t saveSyncMs = 10000;
     std::string fileName;
 
-    if (argc < 2 || argc > 3) {
-        std::cout << "Invalid Input. Usage: ./gameboy {filename} [--test]\n";
+    if (argc < 2) {
+        std::cout << "Invalid Input. " << usage;
         return 0;
     }
 
     fileName = argv[1];
 
-    if (argc == 3 && std::string(argv[2]) == "--test") {
-        isTestMode = true;
-    } else if (argc == 3) {
-        std::cout << "Invalid flag. Usage: ./gameboy {filename} [--test]\n";
-        return 0;
+    try {
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--test") {
+                isTestMode = true;
+            } else if (arg == "--speed" && i + 1 < argc) {
+                speed = std::stod(argv[++i]);
+            } else if (arg == "--unthrottled") {
+                throttled = false;
+            } else if (arg == "--save-sync" && i + 1 < argc) {
+                saveSyncMs = static_cast<uint32_t>(std::stod(argv[++i]) * 1000);
+            } else {
+                std::cout << "Invalid flag. " << usage;
+                return 0;
+            }
+        }
+    } catch (const std::logic_error&) {
+        // std::stod throws invalid_argument or out_of_range on a bad number
+        std::cout << "Invalid number. " << usage;
+        return 1;
     }
 
-    std::vector<char> buffer = readFile(fileName);
-    std::vector<uint8_t> uintBuffer(buffer.begin(), buffer.end());
-
-    Cartridge cartridge(std::move(uintBuffer), fileName);
+    Cartridge cartridge(fileName);
     if (isTestMode) {
         cartridge.printInfo();
     }
+    try {
+        cartridge.openSaveFile();
+    } catch (const std::exception& exception) {
+        std::cerr << "Battery RAM won't be saved: " << exception.what() << std::endl;
+    }
 
-    Gameboy emu(cartridge);
-    emu.run();
-};
+    // The emulator runs on its own thread. This one owns SDL (which wants its window
+    // and events on the main thread): it polls input and presents frames, so waiting
+    // for vsync never holds up emulation
+    Display display;
+    NullFrameSink frameSink;
+    Gameboy emu(cartridge, frameSink);
+    FrameRing& frames = emu.getFrameRing();
+    InputQueue input;
+    std::atomic<bool> quit{false};
+
+    FramePacer pacer(Gameboy::FRAME_RATE);
+    pacer.setSpeed(speed);
+    pacer.setThrottled(throttled);
+
+    // One quick save slot next to the ROM
+    std::string stateFileName = fileName + ".state";
+    std::thread emulationThread(runEmulation, std::ref(emu), std::ref(input), std::ref(pacer), std::cref(quit),
+                                std::cref(stateFileName));
+
+    // The title shows the speed actually reached, refreshed twice a second
+    uint32_t lastTitleUpdate = 0;
+    uint32_t lastSaveSync = 0;
+
+    SDL_Event event;
+    while (!quit.load(std::memory_order_relaxed)) {
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                quit.store(true, std::memory_order_relaxed);
+            } else if (event.type == SDL_KEYDOWN && handleHotkey(event.key.keysym.sym, pacer)) {
+                continue;
+            } else if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
+                InputEvent inputEvent{InputEvent::Type::BUTTON, 0, event.type == SDL_KEYDOWN};
+                if (event.key.keysym.sym == SDLK_F5 || event.key.keysym.sym == SDLK_F9) {
+                    if (event.type != SDL_KEYDOWN || event.key.repeat) {
+                        continue;
+                    }
+                    inputEvent.type = (event.key.keysym.sym == SDLK_F5) ?
+                        InputEvent::Type::SAVE_STATE : InputEvent::Type::LOAD_STATE;
+                } else if (event.key.keysym.sym == SDLK_TAB || event.key.keysym.sym == SDLK_BACKSPACE) {
+                    // Turbo and rewind while held - key repeats would only queue them again
+                    if (event.key.repeat) {
+                        continue;
+                    }
+                    inputEvent.type = (event.key.keysym.sym == SDLK_TAB) ?
+                        InputEvent::Type::TURBO : InputEvent::Type::REWIND;
+                } else {
+                    int button = getButtonIndex(event.key.keysym.sym);
+                    if (button < 0) {
+                        continue;
+                    }
+                    inputEvent.button = static_cast<uint8_t>(button);
+                }
+                // The emulation thread empties the queue every frame - never drop a
+                // release, or the button would stay held
+                while (!input.push(inputEvent)) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        uint32_t ticks = SDL_GetTicks();
+        if (ticks - lastTitleUpdate >= 500) {
+            char target[16];
+            if (pacer.isFastForward()) {
+                std::snprintf(target, sizeof(target), "turbo");
+            } else if (pacer.isThrottled()) {
+                std::snprintf(target, sizeof(target), "%.2fx", pacer.getSpeed());
+            } else {
+                std::snprintf(target, sizeof(target), "unthrottled");
+            }
+            char title[64];
+            std::snprintf(title, sizeof(title), "Gameboy - %.0f%% speed (%s)", pacer.getMeasuredSpeed() * 100, target);
+            display.setTitle(title);
+            lastTitleUpdate = ticks;
+        }
+        // Syncing the mapping waits on the disk, so it happens here rather than on the
+        // emulation thread, which keeps writing to it meanwhile
+        if (ticks - lastSaveSync >= saveSyncMs) {
+            cartridge.syncSaveFile();
+            lastSaveSync = ticks;
+        }
+
+        if (frames.hasNewFrame()) {
+            display.present(frames.acquireLatest());
+        } else {
+            SDL_Delay(1);
+        }
+    }
+
+    emulationThread.join();
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    std::runtime_error fileError(const std::string& action, const std::string& path) {
+        return std::runtime_error("Failed to " + action + " " + path + ": " + std::strerror(errno));
+    }
+} // namespace
+
+MappedFile::MappedFile(const std::string& path) : path(path), writable(false) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw fileError("open", path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Failed to map " + path + ": empty or unreadable file");
+    }
+    mappedSize = static_cast<size_t>(info.st_size);
+    void* address = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        throw fileError("map", path);
+    }
+    mapping = static_cast<uint8_t*>(address);
+}
+
+MappedFile::MappedFile(const std::string& path, size_t size) : path(path), mappedSize(size), writable(true) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw fileError("open", path);
+    }
+    // New and short files are zero filled up to size, longer ones are left alone
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (static_cast<size_t>(info.st_size) < size && ftruncate(fd, size) != 0)) {
+        std::runtime_error error = fileError("resize", path);
+        close(fd);
+        throw error;
+    }
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // The mapping keeps the file open
+    close(fd);
+    if (address == MAP_FAILED) {
+        throw fileError("map", path);
+    }
+    mapping = static_cast<uint8_t*>(address);
+}
+
+MappedFile::~MappedFile() {
+    // Unmapping doesn't wait for the disk, the page cache still holds the writes
+    munmap(mapping, mappedSize);
+}
+
+void MappedFile::sync() {
+    if (writable) {
+        msync(mapping, mappedSize, MS_SYNC);
+    }
+}
+
+#else
+#include <fstream>
+
+MappedFile::MappedFile(const std::string& path) : path(path), writable(false) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    buffer.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    if (buffer.empty() || !file.read(reinterpret_cast<char*>(buffer.data()), buffer.size())) {
+        throw std::runtime_error("Failed to read " + path);
+    }
+    mapping = buffer.data();
+    mappedSize = buffer.size();
+}
+
+MappedFile::MappedFile(const std::string& path, size_t size) :
+    path(path), mappedSize(size), writable(true), buffer(size, 0) {
+    std::ifstream file(path, std::ios::binary);
+    if (file.is_open()) {
+        file.read(reinterpret_cast<char*>(buffer.data()), size);
+    }
+    mapping = buffer.data();
+    // Create it now so a missing directory or permission shows up here rather than on exit
+    sync();
+}
+
+MappedFile::~MappedFile() {
+    try {
+        sync();
+    } catch (const std::exception&) {
+        // Nowhere left to report it
+    }
+}
+
+void MappedFile::sync() {
+    if (!writable) {
+        return;
+    }
+    std::ofstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file.is_open()) {
+        file.open(path, std::ios::binary | std::ios::out);
+    }
+    if (!file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size())) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
+#endif
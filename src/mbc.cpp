@@ -1,3 +1,181 @@
 #include "mbc.hpp"
+#include <ctime>
 #include <fstream>
 
+namespace {
+    constexpr uint64_t SECONDS_PER_DAY = 86400;
+    // The day counter is 9 bits
+    constexpr uint64_t MAX_DAYS = 512;
+    constexpr std::array<uint8_t, 5> RTC_REGISTER_MASKS = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+
+    uint64_t readLittleEndian(const Span<uint8_t>& bytes, size_t offset, size_t size) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < size; i++) {
+            value |= static_cast<uint64_t>(bytes[offset + i]) << (8 * i);
+        }
+        return value;
+    }
+
+    void writeLittleEndian(const Span<uint8_t>& bytes, size_t offset, size_t size, uint64_t value) {
+        for (size_t i = 0; i < size; i++) {
+            bytes[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+} // namespace
+
+std::array<uint8_t, MBC3::RTC_REGISTER_COUNT> MBC3::readClock() {
+    // Rebase on the current cycle so the overflow below can adjust rtcCycles directly
+    if (!rtcHalted) {
+        uint64_t now = getCycle();
+        rtcCycles += now - rtcBaseCycle;
+        rtcBaseCycle = now;
+    }
+
+    uint64_t seconds = rtcCycles / CYCLES_PER_SECOND;
+    uint64_t days = seconds / SECONDS_PER_DAY;
+    if (days >= MAX_DAYS) {
+        // The day counter wraps and sets the carry flag, which stays set until cleared
+        dayCarry = true;
+        rtcCycles %= MAX_DAYS * SECONDS_PER_DAY * CYCLES_PER_SECOND;
+        seconds = rtcCycles / CYCLES_PER_SECOND;
+        days = seconds / SECONDS_PER_DAY;
+    }
+
+    return {
+        static_cast<uint8_t>(seconds % 60),
+        static_cast<uint8_t>((seconds / 60) % 60),
+        static_cast<uint8_t>((seconds / 3600) % 24),
+        static_cast<uint8_t>(days & 0xFF),
+        static_cast<uint8_t>(((days >> 8) & DAY_HIGH_BIT) | (rtcHalted ? HALT_BIT : 0) | (dayCarry ? DAY_CARRY_BIT : 0)),
+    };
+}
+
+void MBC3::setClockTime(const std::array<uint8_t, RTC_REGISTER_COUNT>& registers, uint64_t subSecondCycles) {
+    uint64_t days = registers[RTC_DAY_LOW] | ((registers[RTC_DAY_HIGH] & DAY_HIGH_BIT) << 8);
+    uint64_t seconds = ((days * 24 + registers[RTC_HOURS]) * 60 + registers[RTC_MINUTES]) * 60 + registers[RTC_SECONDS];
+    rtcCycles = seconds * CYCLES_PER_SECOND + subSecondCycles;
+    rtcBaseCycle = getCycle();
+    rtcHalted = registers[RTC_DAY_HIGH] & HALT_BIT;
+    dayCarry = registers[RTC_DAY_HIGH] & DAY_CARRY_BIT;
+}
+
+void MBC3::writeClockRegister(uint8_t index, uint8_t value) {
+    std::array<uint8_t, RTC_REGISTER_COUNT> registers = readClock();
+    // Writing the seconds restarts the current second
+    uint64_t subSecondCycles = (index == RTC_SECONDS) ? 0 : rtcCycles % CYCLES_PER_SECOND;
+    registers[index] = value & RTC_REGISTER_MASKS[index];
+    setClockTime(registers, subSecondCycles);
+    writeFooter();
+}
+
+void MBC3::writeFooter() {
+    if (rtcFooter.size() < RTC_FOOTER_SIZE) {
+        return;
+    }
+    std::array<uint8_t, RTC_REGISTER_COUNT> current = readClock();
+    for (size_t i = 0; i < RTC_REGISTER_COUNT; i++) {
+        writeLittleEndian(rtcFooter, i * 4, 4, current[i]);
+        writeLittleEndian(rtcFooter, (RTC_REGISTER_COUNT + i) * 4, 4, latchedRtc[i]);
+    }
+    writeLittleEndian(rtcFooter, RTC_REGISTER_COUNT * 8, 8, static_cast<uint64_t>(std::time(nullptr)));
+}
+
+void MBC3::readFooter() {
+    if (rtcFooter.size() < RTC_FOOTER_SIZE) {
+        return;
+    }
+    // A new save file is all zeros
+    uint64_t savedTime = readLittleEndian(rtcFooter, RTC_REGISTER_COUNT * 8, 8);
+    if (savedTime == 0) {
+        return;
+    }
+
+    std::array<uint8_t, RTC_REGISTER_COUNT> registers;
+    for (size_t i = 0; i < RTC_REGISTER_COUNT; i++) {
+        registers[i] = static_cast<uint8_t>(readLittleEndian(rtcFooter, i * 4, 4)) & RTC_REGISTER_MASKS[i];
+        latchedRtc[i] = static_cast<uint8_t>(readLittleEndian(rtcFooter, (RTC_REGISTER_COUNT + i) * 4, 4));
+    }
+    setClockTime(registers, 0);
+
+    // The clock kept running while the emulator was closed
+    uint64_t now = static_cast<uint64_t>(std::time(nullptr));
+    if (!rtcHalted && now > savedTime) {
+        rtcCycles += (now - savedTime) * CYCLES_PER_SECOND;
+    }
+}
+
+void MBC3::setClockSource(const Scheduler* scheduler) {
+    if (!rtcHalted) {
+        rtcCycles += getCycle() - rtcBaseCycle;
+    }
+    clock = scheduler;
+    rtcBaseCycle = getCycle();
+}
+
+void MBC3::write(uint16_t address, uint8_t value) {
+    if (inRange(address, RAM_ENABLE_START, RAM_ENABLE_END)) {
+        // Enables the clock registers as well
+        ramEnabled = ((value & 0xF) == 0xA);
+    } else if (inRange(address, ROM_BANK_SELECT_START, ROM_BANK_SELECT_END)) {
+        romBankNumber = MAX(value & 0x7F, 1);
+    } else if (inRange(address, RAM_BANK_SELECT_START, RAM_BANK_SELECT_END)) {
+        ramBankSelect = value & 0x0F;
+    } else if (inRange(address, LATCH_CLOCK_START, LATCH_CLOCK_END)) {
+        // Writing 0 then 1 copies the running clock into the registers games read
+        if (lastLatchWrite == 0x00 && value == 0x01) {
+            latchedRtc = readClock();
+            writeFooter();
+        }
+        lastLatchWrite = value;
+        return;
+    } else if (inRange(address, RAM_BANK_START, RAM_BANK_END)) {
+        if (ramBankStart) {
+            ramBankStart[address - RAM_BANK_START] = value;
+        } else if (ramEnabled && ramBankSelect >= RTC_REGISTER_FIRST && ramBankSelect <= RTC_REGISTER_LAST) {
+            writeClockRegister(ramBankSelect - RTC_REGISTER_FIRST, value);
+        }
+        return;
+    }
+    updateBanks();
+}
+
+uint8_t MBC3::read(uint16_t address) const {
+    if (address <= ROM_BANK_0_END) {
+        return address < rom.size() ? rom[address] : 0xFF;
+    } else if (inRange(address, ROM_BANK_N_START, ROM_BANK_N_END)) {
+        return romBankNStart ? romBankNStart[address - ROM_BANK_N_START] : 0xFF;
+    } else if (inRange(address, RAM_BANK_START, RAM_BANK_END)) {
+        if (ramBankStart) {
+            return ramBankStart[address - RAM_BANK_START];
+        }
+        if (ramEnabled && ramBankSelect >= RTC_REGISTER_FIRST && ramBankSelect <= RTC_REGISTER_LAST) {
+            return latchedRtc[ramBankSelect - RTC_REGISTER_FIRST];
+        }
+    }
+    return 0xFF;
+}
+
+void MBC3::saveState(StateWriter& state) const {
+    state.write(ramEnabled);
+    state.write(romBankNumber);
+    state.write(ramBankSelect);
+    state.write(lastLatchWrite);
+    state.write(rtcCycles);
+    state.write(rtcBaseCycle);
+    state.write(rtcHalted);
+    state.write(dayCarry);
+    state.write(latchedRtc);
+}
+
+void MBC3::loadState(StateReader& state) {
+    state.read(ramEnabled);
+    state.read(romBankNumber);
+    state.read(ramBankSelect);
+    state.read(lastLatchWrite);
+    state.read(rtcCycles);
+    state.read(rtcBaseCycle);
+    state.read(rtcHalted);
+    state.read(dayCarry);
+    state.read(latchedRtc);
+    updateBanks();
+}
@@ -1,18 +1,145 @@
 #include "mmu.hpp"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 
-MMU::MMU(Cartridge& cartridge) : cartridge(cartridge), io(IO()) {}
+MMU::MMU(Cartridge& cartridge, Scheduler& scheduler) : cartridge(cartridge), scheduler(scheduler), io(scheduler) {
+    mapPages(MemoryMap::VRAM_START, MemoryMap::VRAM_END, vram.data(), vram.data());
+    // Tile data writes go through writeUnmapped so the PPU's decoded tiles can be invalidated
+    mapPages(MemoryMap::VRAM_START, MemoryMap::TILE_DATA_END, vram.data(), nullptr);
+    mapPages(MemoryMap::WRAM_START, MemoryMap::WRAM_END, wram.data(), wram.data());
+    remapCartridge();
+}
+
+void MMU::mapPages(uint16_t start, uint16_t end, const uint8_t* readBase, uint8_t* writeBase) {
+    for (int page = start >> PAGE_SHIFT; page <= (end >> PAGE_SHIFT); page++) {
+        size_t offset = (page << PAGE_SHIFT) - start;
+        readPages[page] = readBase ? readBase + offset : nullptr;
+        writePages[page] = writeBase ? writeBase + offset : nullptr;
+    }
+}
+
+void MMU::mapReadPages(uint16_t start, uint16_t end, const uint8_t* base) {
+    const uint8_t** pages = readPages.data() + (start >> PAGE_SHIFT);
+    int count = (end >> PAGE_SHIFT) - (start >> PAGE_SHIFT) + 1;
+    if (!base) {
+        std::fill_n(pages, count, nullptr);
+        return;
+    }
+    for (int page = 0; page < count; page++) {
+        pages[page] = base + page * PAGE_SIZE;
+    }
+}
+
+void MMU::remapCartridge() {
+    // Only what actually moved is remapped - games often select the bank they already
+    // have, and a new ROM mapping sends the CPU back to its block cache
+    // ROM is never written directly - writes there are MBC register writes
+    const uint8_t* romBank0 = cartridge.romBank0();
+    const uint8_t* romBankN = cartridge.romBankN();
+    if (romBank0 != mappedRomBank0) {
+        mapReadPages(MemoryMap::ROM_0_START, MemoryMap::ROM_0_END, romBank0);
+        mappedRomBank0 = romBank0;
+        mappingVersion++;
+    }
+    if (romBankN != mappedRomBankN) {
+        mapReadPages(MemoryMap::ROM_N_START, MemoryMap::ROM_N_END, romBankN);
+        mappedRomBankN = romBankN;
+        mappingVersion++;
+    }
+
+    uint8_t* ramBank = cartridge.ramBank();
+    if (ramBank != mappedRamBank) {
+        mapPages(MemoryMap::ERAM_START, MemoryMap::ERAM_END, ramBank, ramBank);
+        mappedRamBank = ramBank;
+    }
+}
+
+void MMU::saveState(StateWriter& state) const {
+    state.write(vram);
+    state.write(wram);
+    state.write(oam);
+    state.write(hram);
+    state.write(interruptRegister);
+    state.write(oamDmaActive);
+    io.saveState(state);
+}
 
-void MMU::tick(int cycles) {
-    io.tick(cycles);
+void MMU::loadState(StateReader& state) {
+    state.read(vram);
+    state.read(wram);
+    state.read(oam);
+    state.read(hram);
+    state.read(interruptRegister);
+    state.read(oamDmaActive);
+    io.loadState(state);
+
+    remapCartridge();
+    writeVersion++;
+    dirtyTiles.markAll();
+    dirtyPages = ~0ull;
+}
+
+void MMU::startOamDma(uint8_t sourcePage) {
+    // Sources from 0xE000 up read the WRAM below them, like echo RAM
+    uint16_t source = sourcePage << PAGE_SHIFT;
+    if (source >= MemoryMap::ECHO_START) {
+        source -= MemoryMap::ECHO_START - MemoryMap::WRAM_START;
+    }
+    // The transfer never leaves its source page
+    const uint8_t* page = readPages[source >> PAGE_SHIFT];
+    if (page) {
+        std::memcpy(oam.data(), page, oam.size());
+    } else {
+        // External RAM the MBC has not mapped
+        for (size_t i = 0; i < oam.size(); i++) {
+            oam[i] = readRegion(static_cast<uint16_t>(source + i));
+        }
+    }
+    oamDmaActive = true;
+    scheduler.scheduleIn(EventType::OAM_DMA, OAM_DMA_CYCLES);
 }
 
 void MMU::requestInterrupt(uint8_t interrupt) {
     io.requestInterrupt(interrupt);
 }
 
-uint8_t MMU::read(uint16_t address) {
+uint8_t MMU::readUnmapped(uint16_t address) {
+    // HRAM shares its page with IO, so catch it before the full region lookup
+    if (inRange(address, MemoryMap::HRAM_START, MemoryMap::HRAM_END)) {
+        return hram[address - MemoryMap::HRAM_START];
+    }
+    // IO registers are read every scanline by the PPU and every instruction for IF
+    if (inRange(address, MemoryMap::IO_START, MemoryMap::IO_END)) {
+        return io.read(address);
+    }
+    return readRegion(address);
+}
+
+void MMU::writeUnmapped(uint16_t address, uint8_t value) {
+    if (inRange(address, MemoryMap::HRAM_START, MemoryMap::HRAM_END)) {
+        hram[address - MemoryMap::HRAM_START] = value;
+        return;
+    }
+    // MBC registers, written whenever a game switches banks
+    if (address <= MemoryMap::ROM_N_END) {
+        writeVersion++;
+        cartridge.write(address, value);
+        remapCartridge();
+        return;
+    }
+    // Plain memory as far as the CPU is concerned, so no writeVersion bump
+    if (inRange(address, MemoryMap::VRAM_START, MemoryMap::TILE_DATA_END)) {
+        vram[address - MemoryMap::VRAM_START] = value;
+        dirtyTiles.mark(address - MemoryMap::VRAM_START);
+        dirtyPages |= DirtyPages::PAGE_BITS[address >> PAGE_SHIFT];
+        return;
+    }
+    writeRegion(address, value);
+}
+
+uint8_t MMU::readRegion(uint16_t address) {
     switch (getMemoryRegion(address)) {
         case MemoryRegion::ROM_0:
         case MemoryRegion::ROM_N:
@@ -23,7 +150,8 @@ uint8_t MMU::read(uint16_t address) {
         case MemoryRegion::WRAM:
             return wram.at(address - MemoryMap::WRAM_START);
         case MemoryRegion::OAM:
-            return oam.at(address - MemoryMap::OAM_START);
+            // Locked while a DMA transfer owns it
+            return oamDmaActive ? 0xFF : oam.at(address - MemoryMap::OAM_START);
         case MemoryRegion::IO:
             // std::cout << "Attempted read from IO address: 0x" << std::hex << address << std::endl;
             // TODO handle IO
@@ -44,25 +172,40 @@ uint8_t MMU::read(uint16_t address) {
     }
 }
 
-void MMU::write(uint16_t address, uint8_t value) {
+void MMU::writeRegion(uint16_t address, uint8_t value) {
+    writeVersion++;
     switch (getMemoryRegion(address)) {
         case MemoryRegion::ROM_0:
         case MemoryRegion::ROM_N:
+            // Writes to ROM are MBC register writes which may switch banks
+            cartridge.write(address, value);
+            remapCartridge();
+            break;
         case MemoryRegion::ERAM: // ERAM writes also go through MBC
             cartridge.write(address, value);
             break;
         case MemoryRegion::VRAM:
             vram.at(address - MemoryMap::VRAM_START) = value;
+            dirtyPages |= DirtyPages::PAGE_BITS[address >> PAGE_SHIFT];
+            if (address <= MemoryMap::TILE_DATA_END) {
+                dirtyTiles.mark(address - MemoryMap::VRAM_START);
+            }
             break;
         case MemoryRegion::WRAM:
             wram.at(address - MemoryMap::WRAM_START) = value;
+            dirtyPages |= DirtyPages::PAGE_BITS[address >> PAGE_SHIFT];
             break;
         case MemoryRegion::OAM:
-            oam.at(address - MemoryMap::OAM_START) = value;
+            if (!oamDmaActive) {
+                oam.at(address - MemoryMap::OAM_START) = value;
+            }
             break;
         case MemoryRegion::IO:
             
             io.write(address, value);
+            if (address == OAM_DMA_ADDRESS) {
+                startOamDma(value);
+            }
             // std::cout << "Attempted write to IO address: 0x" << std::hex << address << " with value: 0x" << std::hex << (int)value << std::endl;
             // TODO Implement actual IO register writes here
             break;
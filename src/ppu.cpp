@@ -1,316 +1,674 @@
 #include "ppu.hpp"
+#include "tile_decode.hpp"
+#include <algorithm>
 #include <cassert>
-#include <stdexcept>
 #include <cstddef>
+#include <cstring>
+#include <limits>
 
-Display::Display() {
-    SDL_Init(SDL_INIT_VIDEO);
-    window = SDL_CreateWindow("Gameboy", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
-}
+PPU::PPU(MMU& bus, FrameSink& frameSink, Scheduler& scheduler) :
+    bus(bus), vram(bus.getVram()), oam(bus.getOam()), dirtyTiles(bus.getDirtyTiles()),
+    registerLog(bus.getRenderRegisterLog()), frameSink(frameSink), scheduler(scheduler) {}
 
-Display::~Display() {
-    SDL_DestroyTexture(texture);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+void PPU::setRenderer(PPU_RENDERER newRenderer) {
+    renderer = newRenderer;
+    registerLog.enabled = (renderer == PPU_RENDERER::PIXEL_FIFO);
+    registerLog.writes.clear();
 }
 
-void Display::redraw(const std::array<uint8_t, SCREEN_WIDTH * SCREEN_HEIGHT * 4>& buffer) {
-    SDL_UpdateTexture(texture, NULL, buffer.data(), SCREEN_WIDTH * 4);
-    SDL_RenderCopy(renderer, texture, NULL, NULL);
-    SDL_RenderPresent(renderer);
-}
+void PPU::handleModeEvent(uint64_t time) {
+    uint8_t currentScanline = bus.read(LY_ADDRESS);
 
-PPU::PPU(MMU& bus) : bus(bus), display(Display()) {}
+    switch (currentMode) {
+        case PPU_MODE::OAM_SCAN:
+            scanOAM();
+            lineRenderer = renderer;
+            if (!drawingFrame) {
+                // Skipped frames still need the right mode 3 length
+                pixelTransferDots = computePixelTransferDots(readLineRegisters());
+            } else if (lineRenderer == PPU_RENDERER::PIXEL_FIFO) {
+                startPixelFifo(time);
+            } else {
+                pixelTransferDots = computePixelTransferDots(readLineRegisters());
+            }
+            enterMode(PPU_MODE::PIXEL_TRANSFER, time);
+            break;
+        case PPU_MODE::PIXEL_TRANSFER:
+            if (!drawingFrame) {
+                enterMode(PPU_MODE::HBLANK, time);
+            } else if (lineRenderer == PPU_RENDERER::PIXEL_FIFO) {
+                if (!runPixelFifo(time)) {
+                    // Not done yet, come back when the rest of the line could be
+                    int remaining = std::max(FETCHER_STARTUP_DOTS - fifo.dot, 0) +
+                        fifo.stall + fifo.discard + (SCREEN_WIDTH - fifo.x);
+                    scheduler.scheduleAt(EventType::PPU_MODE, time + remaining);
+                    break;
+                }
+                // The line may have finished before this event
+                pixelTransferDots = fifo.dot;
+                enterMode(PPU_MODE::HBLANK, fifo.startTime + fifo.dot);
+            } else {
+                renderScanline(readLineRegisters());
+                enterMode(PPU_MODE::HBLANK, time);
+            }
+            break;
+        case PPU_MODE::HBLANK:
+            currentScanline++;
+            setScanline(currentScanline);
 
-void PPU::tick(int cycles) {
-    uint8_t lcdc = bus.read(LCDC_ADDRESS);
-    bool lcdEnabled = (lcdc >> 7) & 1;
+            if (currentScanline == 144) {
+                bus.requestInterrupt(0x01); // V-blank interrupt
+                if (drawingFrame) {
+                    frameSink.presentFrame(frames.publish());
+                }
+                // Writes made outside pixel transfer are never replayed
+                registerLog.writes.clear();
+                frameCount++;
+                drawingFrame = (frameCount % frameSkip == 0);
+                enterMode(PPU_MODE::VBLANK, time);
+            } else {
+                enterMode(PPU_MODE::OAM_SCAN, time);
+            }
+            break;
+        case PPU_MODE::VBLANK:
+            currentScanline++;
+            if (currentScanline > 153) {
+                setScanline(0);
+                enterMode(PPU_MODE::OAM_SCAN, time);
+            } else {
+                setScanline(currentScanline);
+                // Still V-blank - no mode change but the next line needs an event
+                scheduler.scheduleAt(EventType::PPU_MODE, time + DOTS_PER_SCANLINE);
+            }
+            break;
+    }
+}
+
+void PPU::handleRegisterWrite(uint64_t time) {
+    bool enabled = (bus.read(LCDC_ADDRESS) >> 7) & 1;
 
-    if (!lcdEnabled) {
+    if (enabled && !lcdEnabled) {
+        // Turning the LCD on starts a fresh frame
+        setScanline(0);
+        enterMode(PPU_MODE::OAM_SCAN, time);
+    } else if (!enabled && lcdEnabled) {
         // If LCD is disabled, reset scanline and mode
-        bus.write(LY_ADDRESS, 0);
-        m_dots = 0;
+        scheduler.cancel(EventType::PPU_MODE);
+        setScanline(0);
         currentMode = PPU_MODE::HBLANK;
-        return;
+        bus.write(STAT_ADDRESS, bus.read(STAT_ADDRESS) & 0xFC);
+    } else {
+        compareLYC(); // LYC changed
     }
+    lcdEnabled = enabled;
+}
 
-    m_dots += cycles;
-    uint8_t currentScanline = bus.read(LY_ADDRESS);
-    PPU_MODE newMode = currentMode;
+void PPU::enterMode(PPU_MODE mode, uint64_t time) {
+    currentMode = mode;
+    uint8_t stat = bus.read(STAT_ADDRESS);
+    stat &= 0xFC; // Clear mode bits
+    stat |= static_cast<uint8_t>(currentMode);
+    bus.write(STAT_ADDRESS, stat);
 
+    // Request STAT interrupts
+    int modeDots = 0;
     switch (currentMode) {
         case PPU_MODE::HBLANK:
-            if (m_dots >= DOTS_PER_SCANLINE) {
-                m_dots -= DOTS_PER_SCANLINE;
-                currentScanline++;
-                bus.write(LY_ADDRESS, currentScanline);
-
-                if (currentScanline == 144) {
-                    newMode = PPU_MODE::VBLANK;
-                    bus.requestInterrupt(0x01); // V-blank interrupt
-                    display.redraw(frameBuffer);
-                } else {
-                    newMode = PPU_MODE::OAM_SCAN;
-                }
+            modeDots = DOTS_PER_SCANLINE - OAM_SCAN_DOTS - pixelTransferDots;
+            if ((stat >> 3) & 1) {
+                bus.requestInterrupt(0x02); // LCD STAT interrupt
             }
             break;
         case PPU_MODE::VBLANK:
-            if (m_dots >= DOTS_PER_SCANLINE) {
-                m_dots -= DOTS_PER_SCANLINE;
-                currentScanline++;
-                bus.write(LY_ADDRESS, currentScanline);
-
-                if (currentScanline > 153) {
-                    newMode = PPU_MODE::OAM_SCAN;
-                    bus.write(LY_ADDRESS, 0); // Reset scanline to 0
-                }
+            modeDots = DOTS_PER_SCANLINE;
+            if ((stat >> 4) & 1) {
+                bus.requestInterrupt(0x02); // LCD STAT interrupt
             }
             break;
         case PPU_MODE::OAM_SCAN:
-            if (m_dots >= 80) {
-                newMode = PPU_MODE::PIXEL_TRANSFER;
+            modeDots = OAM_SCAN_DOTS;
+            if ((stat >> 5) & 1) {
+                bus.requestInterrupt(0x02); // LCD STAT interrupt
             }
             break;
         case PPU_MODE::PIXEL_TRANSFER:
-            if (m_dots >= 80 + 172) { // OAM Scan + Pixel Transfer = 80 + 172 = 252 dots
-                newMode = PPU_MODE::HBLANK;
-                drawScanline();
-            }
+            modeDots = pixelTransferDots;
             break;
     }
 
-    if (newMode != currentMode) {
-        currentMode = newMode;
-        uint8_t stat = bus.read(STAT_ADDRESS);
-        stat &= 0xFC; // Clear mode bits
-        stat |= static_cast<uint8_t>(currentMode);
-        bus.write(STAT_ADDRESS, stat);
+    scheduler.scheduleAt(EventType::PPU_MODE, time + modeDots);
+}
 
-        // Request STAT interrupts
-        if (currentMode == PPU_MODE::HBLANK && ((stat >> 3) & 1)) {
-            bus.requestInterrupt(0x02); // LCD STAT interrupt
-        } else if (currentMode == PPU_MODE::VBLANK && ((stat >> 4) & 1)) {
-            bus.requestInterrupt(0x02); // LCD STAT interrupt
-        } else if (currentMode == PPU_MODE::OAM_SCAN && ((stat >> 5) & 1)) {
-            bus.requestInterrupt(0x02); // LCD STAT interrupt
-        }
-    }
+void PPU::setScanline(uint8_t scanline) {
+    bus.write(LY_ADDRESS, scanline);
+    compareLYC();
+}
+
+void PPU::compareLYC() {
+    uint8_t stat = bus.read(STAT_ADDRESS);
+    bool wasEqual = (stat >> 2) & 1;
 
     // LYC == LY interrupt
     if (bus.read(LY_ADDRESS) == bus.read(LYC_ADDRESS)) {
-        uint8_t stat = bus.read(STAT_ADDRESS);
         stat |= 0x04; // Set coincidence flag
         bus.write(STAT_ADDRESS, stat);
-        if (((stat >> 6) & 1)) {
+        if (!wasEqual && ((stat >> 6) & 1)) {
             bus.requestInterrupt(0x02); // LCD STAT interrupt
         }
     } else {
-        uint8_t stat = bus.read(STAT_ADDRESS);
         stat &= ~0x04; // Clear coincidence flag
         bus.write(STAT_ADDRESS, stat);
     }
 }
 
-uint16_t PPU::getTileAddress(uint8_t tileNumber) {
-    uint8_t lcdControlValue = bus.read(LCDC_ADDRESS);
-    bool tileAddressingMode = static_cast<bool>((lcdControlValue >> 4) & 1);
-
-    uint16_t tileAddress = tileAddressingMode ?
-        TILE_BLOCK_0_START + (TILE_BYTE_SIZE * tileNumber) :
-        TILE_BLOCK_2_START + (TILE_BYTE_SIZE * static_cast<int8_t>(tileNumber));
-
-    return tileAddress;
+void PPU::saveState(StateWriter& state) const {
+    state.write(currentMode);
+    state.write(lcdEnabled);
+    for (const LineSprite& sprite : lineSprites) {
+        state.write(sprite.x);
+        state.write(sprite.oamIndex);
+    }
+    state.write(numLineSprites);
+    state.write(windowTriggered);
+    state.write(windowLine);
+    state.write(pixelTransferDots);
+    state.write(lineRenderer);
+
+    const LineRegisters& registers = fifo.registers;
+    state.write(registers.lcdc);
+    state.write(registers.scx);
+    state.write(registers.scy);
+    state.write(registers.ly);
+    state.write(registers.wx);
+    state.write(registers.wy);
+    state.write(registers.bgp);
+    state.write(registers.obp0);
+    state.write(registers.obp1);
+    state.write(fifo.startTime);
+    state.write(static_cast<uint64_t>(fifo.nextWrite));
+    state.write(fifo.dot);
+    state.write(fifo.x);
+    state.write(fifo.discard);
+    state.write(fifo.stall);
+    state.write(fifo.fetcherX);
+    state.write(fifo.lastPenalizedTile);
+    state.write(fifo.nextSprite);
+    state.write(fifo.windowActive);
+    state.write(fifo.bgPixels);
+    state.write(fifo.bgCount);
+    state.write(fifo.spritePixels);
+
+    state.write(frameCount);
+    state.write(drawingFrame);
+    state.write(frames.getBackBuffer());
 }
 
-void PPU::setPixel(int x, int y, uint8_t value) {
-    assert(value < 4 && "Color value should not exceed 2 bits");
-    assert(x < SCREEN_WIDTH && x >= 0 && y < SCREEN_HEIGHT && y >= 0);
+void PPU::loadState(StateReader& state) {
+    state.read(currentMode);
+    state.read(lcdEnabled);
+    for (LineSprite& sprite : lineSprites) {
+        state.read(sprite.x);
+        state.read(sprite.oamIndex);
+    }
+    state.read(numLineSprites);
+    state.read(windowTriggered);
+    state.read(windowLine);
+    state.read(pixelTransferDots);
+    state.read(lineRenderer);
+
+    LineRegisters& registers = fifo.registers;
+    state.read(registers.lcdc);
+    state.read(registers.scx);
+    state.read(registers.scy);
+    state.read(registers.ly);
+    state.read(registers.wx);
+    state.read(registers.wy);
+    state.read(registers.bgp);
+    state.read(registers.obp0);
+    state.read(registers.obp1);
+    state.read(fifo.startTime);
+    uint64_t nextWrite;
+    state.read(nextWrite);
+    fifo.nextWrite = static_cast<size_t>(nextWrite);
+    state.read(fifo.dot);
+    state.read(fifo.x);
+    state.read(fifo.discard);
+    state.read(fifo.stall);
+    state.read(fifo.fetcherX);
+    state.read(fifo.lastPenalizedTile);
+    state.read(fifo.nextSprite);
+    state.read(fifo.windowActive);
+    state.read(fifo.bgPixels);
+    state.read(fifo.bgCount);
+    state.read(fifo.spritePixels);
+
+    state.read(frameCount);
+    state.read(drawingFrame);
+    state.read(frames.getBackBuffer());
+}
 
-    uint8_t palette = bus.read(BGP_ADDRESS);
-    uint8_t color = (palette >> (value * 2)) & 0x3;
+PPU::Palette PPU::decodePalette(uint8_t palette) {
+    Palette colors;
+    for (int value = 0; value < 4; value++) {
+        colors[value] = SHADES[(palette >> (value * 2)) & 0x3];
+    }
+    return colors;
+}
 
-    uint8_t rgbValue;
-    switch (color) {
-        case 0x00: rgbValue = 0; break; // black
-        case 0x01: rgbValue = 96; break;
-        case 0x02: rgbValue = 192; break;
-        case 0x03: rgbValue = 255; break; //
-        default: throw std::out_of_range("Color value exceeds 2 bits - should not even be reachable");
+void PPU::updateTileCache() {
+    if (!dirtyTiles.any) {
+        return;
     }
 
-    // Set RGBA values
-    int screenOffset = (y * SCREEN_WIDTH + x) * 4;
-    frameBuffer[screenOffset] = rgbValue;
-    frameBuffer[screenOffset + 1] = rgbValue;
-    frameBuffer[screenOffset + 2] = rgbValue;
-    frameBuffer[screenOffset + 3] = 255;
+    for (int tile = 0; tile < DirtyTiles::NUM_TILES; tile++) {
+        if (!dirtyTiles.tiles[tile]) {
+            continue;
+        }
+        const uint8_t* tileData = vram.data() + tile * TILE_BYTE_SIZE;
+        for (int row = 0; row < TILE_PIXEL_SIZE; row++) {
+            TileDecode::decodeRow(tileData + 2 * row, &tileCache[tile][row * TILE_PIXEL_SIZE]);
+        }
+        dirtyTiles.tiles[tile] = false;
+    }
+    dirtyTiles.any = false;
 }
 
-void PPU::drawScanline() {
-    uint8_t lcdControlValue = bus.read(LCDC_ADDRESS);
-    bool tileMapMode = static_cast<bool>((lcdControlValue >> 3) & 1);
+const uint8_t* PPU::getTileRow(uint8_t lcdc, uint8_t tileNumber, uint8_t tileY) const {
+    bool tileAddressingMode = static_cast<bool>((lcdc >> 4) & 1);
 
-    // Entire tile map is 256 * 256 which is way larger than the gameboy screen
-    // meaning only part of the tile map is displayed
-    // scX and scY define the starting offset which wraps around if too large
-    uint8_t scX = bus.read(SCX_ADDRESS);
-    uint8_t scY = bus.read(SCY_ADDRESS);
+    // 1 = tiles 0-255 from 8000; 0 = tiles -128-127 from 9000
+    int tileIndex = tileAddressingMode ?
+        tileNumber :
+        (TILE_BLOCK_2_START - TILE_BLOCK_0_START) / TILE_BYTE_SIZE + static_cast<int8_t>(tileNumber);
 
-    // 1 = 9C00–9FFF; 0 = 9800–9BFF
-    uint16_t tileMapStart = tileMapMode ? TILE_MAP_1_START : TILE_MAP_0_START;
-    uint8_t y = bus.read(LY_ADDRESS);
+    return &tileCache[tileIndex][tileY * TILE_PIXEL_SIZE];
+}
 
-    for (int x = 0; x < SCREEN_WIDTH; x++) {
-        uint8_t bgX = (x + scX) & 0xFF;
-        uint8_t bgY = (y + scY) & 0xFF;
+PPU::LineRegisters PPU::readLineRegisters() {
+    LineRegisters registers;
+    registers.lcdc = bus.read(LCDC_ADDRESS);
+    registers.scx = bus.read(SCX_ADDRESS);
+    registers.scy = bus.read(SCY_ADDRESS);
+    registers.ly = bus.read(LY_ADDRESS);
+    registers.wx = bus.read(WX_ADDRESS);
+    registers.wy = bus.read(WY_ADDRESS);
+    registers.bgp = decodePalette(bus.read(BGP_ADDRESS));
+    registers.obp0 = decodePalette(bus.read(OBP0_ADDRESS));
+    registers.obp1 = decodePalette(bus.read(OBP1_ADDRESS));
+    return registers;
+}
 
-        // Screen is rendered 32 * 32 tiles
-        uint8_t bgXTile = bgX / TILE_PIXEL_SIZE;
-        uint8_t bgYTile = bgY / TILE_PIXEL_SIZE;
+void PPU::drawScanline() {
+    if (renderer == PPU_RENDERER::PIXEL_FIFO) {
+        startPixelFifo(scheduler.getCurrentCycle());
+        runPixelFifo(Scheduler::NEVER);
+    } else {
+        renderScanline(readLineRegisters());
+    }
+}
 
-        // The tile map stores which tile number the current pixel corresponds to
-        uint16_t tileMapOffset = (NUM_TILES_PER_COLUMN * bgYTile) + bgXTile;
-        uint8_t tileNumber = bus.read(tileMapStart + tileMapOffset);
+void PPU::renderScanline(const LineRegisters& registers) {
+    updateTileCache();
 
-        // Get the specific pixel from that tile
-        // Each tile is 2 bytes
-        uint16_t tileAddress = getTileAddress(tileNumber);
-        uint8_t tileX = bgX % TILE_PIXEL_SIZE;
-        uint8_t tileY = bgY % TILE_PIXEL_SIZE;
+    std::array<uint8_t, SCREEN_WIDTH> colors;
+    drawBackground(registers, colors.data());
+    drawWindow(registers, colors.data());
 
-        // Each row on a tile is represented by 2 bytes
-        // The first byte contains the upper bits of the color
-        // while the second byte contains the lower bits of the color
-        uint8_t tileByte1 = bus.read(tileAddress + (2 * tileY));
-        uint8_t tileByte2 = bus.read(tileAddress + (2 * tileY + 1));
+    uint8_t* line = frames.getBackBuffer().data() + registers.ly * SCREEN_WIDTH * 4;
+    TileDecode::expandPixels(colors.data(), registers.bgp[0].data(), line, SCREEN_WIDTH);
+    drawSprites(registers, colors.data(), line);
+}
 
-        uint8_t upperColorBit = (tileByte1 >> (7 - tileX)) & 1;
-        uint8_t lowerColorBit = (tileByte2 >> (7 - tileX)) & 1;
-        uint8_t colorValue = (upperColorBit << 1) | lowerColorBit;
+void PPU::drawBackground(const LineRegisters& registers, uint8_t* colors) {
+    // 1 = 9C00–9FFF; 0 = 9800–9BFF
+    bool tileMapMode = static_cast<bool>((registers.lcdc >> 3) & 1);
+    uint16_t tileMapStart = tileMapMode ? TILE_MAP_1_START : TILE_MAP_0_START;
 
-        setPixel(x, y, colorValue);
+    // Entire tile map is 256 * 256 which is way larger than the gameboy screen
+    // meaning only part of the tile map is displayed
+    // scX and scY define the starting offset which wraps around if too large
+    uint8_t bgY = registers.ly + registers.scy;
+    const uint8_t* tileMapRow = vram.data() + (tileMapStart - TILE_BLOCK_0_START) +
+        NUM_TILES_PER_COLUMN * (bgY / TILE_PIXEL_SIZE);
+    uint8_t tileY = bgY % TILE_PIXEL_SIZE;
+
+    // A line that isn't tile aligned touches 21 tiles, copy all of them and
+    // skip the part of the first one that is scrolled off screen
+    std::array<uint8_t, SCREEN_WIDTH + TILE_PIXEL_SIZE> pixels;
+    uint8_t firstTile = registers.scx / TILE_PIXEL_SIZE;
+    for (int tile = 0; tile <= SCREEN_WIDTH / TILE_PIXEL_SIZE; tile++) {
+        uint8_t tileNumber = tileMapRow[(firstTile + tile) % NUM_TILES_PER_ROW];
+        std::memcpy(&pixels[tile * TILE_PIXEL_SIZE], getTileRow(registers.lcdc, tileNumber, tileY), TILE_PIXEL_SIZE);
     }
-    drawWindow();
-    drawSprites();
+    std::memcpy(colors, &pixels[registers.scx % TILE_PIXEL_SIZE], SCREEN_WIDTH);
 }
 
-void PPU::drawWindow() {
-    uint8_t lcdControlValue = bus.read(LCDC_ADDRESS);
-    bool windowDisplayEnable = static_cast<bool>((lcdControlValue >> 5) & 1);
-    if (!windowDisplayEnable) {
+void PPU::drawWindow(const LineRegisters& registers, uint8_t* colors) {
+    if (!isWindowVisible(registers)) {
         return;
     }
 
-    uint8_t windowTileMapDisplaySelect = static_cast<bool>((lcdControlValue >> 6) & 1);
+    uint8_t windowTileMapDisplaySelect = static_cast<bool>((registers.lcdc >> 6) & 1);
     uint16_t windowTileMapStart = windowTileMapDisplaySelect ? TILE_MAP_1_START : TILE_MAP_0_START;
 
-    uint8_t wx = bus.read(WX_ADDRESS) - 7;
-    uint8_t wy = bus.read(WY_ADDRESS);
-
-    uint8_t currentScanline = bus.read(LY_ADDRESS);
-
-    if (currentScanline >= wy && currentScanline < (wy + SCREEN_HEIGHT)) {
-        for (int x = 0; x < SCREEN_WIDTH; x++) {
-            if (x >= wx && x < (wx + SCREEN_WIDTH)) {
-                uint8_t windowX = x - wx;
-                uint8_t windowY = currentScanline - wy;
-
-                uint8_t windowXTile = windowX / TILE_PIXEL_SIZE;
-                uint8_t windowYTile = windowY / TILE_PIXEL_SIZE;
-
-                uint16_t tileMapOffset = (NUM_TILES_PER_COLUMN * windowYTile) + windowXTile;
-                uint8_t tileNumber = bus.read(windowTileMapStart + tileMapOffset);
+    uint8_t wx = registers.wx - 7;
+    uint8_t windowY = windowLine++;
+    const uint8_t* tileMapRow = vram.data() + (windowTileMapStart - TILE_BLOCK_0_START) +
+        NUM_TILES_PER_COLUMN * (windowY / TILE_PIXEL_SIZE);
+    uint8_t tileY = windowY % TILE_PIXEL_SIZE;
+
+    // The window always starts at the left edge of its first tile
+    int width = SCREEN_WIDTH - wx;
+    std::array<uint8_t, SCREEN_WIDTH + TILE_PIXEL_SIZE> pixels;
+    for (int tile = 0; tile * TILE_PIXEL_SIZE < width; tile++) {
+        std::memcpy(&pixels[tile * TILE_PIXEL_SIZE], getTileRow(registers.lcdc, tileMapRow[tile], tileY), TILE_PIXEL_SIZE);
+    }
+    std::memcpy(colors + wx, pixels.data(), width);
+}
 
-                uint16_t tileAddress = getTileAddress(tileNumber);
-                uint8_t tileX = windowX % TILE_PIXEL_SIZE;
-                uint8_t tileY = windowY % TILE_PIXEL_SIZE;
+void PPU::scanOAM() {
+    bool spriteSize = static_cast<bool>((bus.read(LCDC_ADDRESS) >> 2) & 1); // 0: 8x8, 1: 8x16
+    int spriteHeight = spriteSize ? 16 : 8;
+    int currentScanline = bus.read(LY_ADDRESS);
 
-                uint8_t tileByte1 = bus.read(tileAddress + (2 * tileY));
-                uint8_t tileByte2 = bus.read(tileAddress + (2 * tileY + 1));
+    if (currentScanline == 0) {
+        windowTriggered = false;
+        windowLine = 0;
+    }
+    if (currentScanline == bus.read(WY_ADDRESS)) {
+        windowTriggered = true;
+    }
 
-                uint8_t upperColorBit = (tileByte1 >> (7 - tileX)) & 1;
-                uint8_t lowerColorBit = (tileByte2 >> (7 - tileX)) & 1;
-                uint8_t colorValue = (upperColorBit << 1) | lowerColorBit;
+    // OAM contains 40 sprites, each 4 bytes long
+    numLineSprites = 0;
+    for (uint8_t i = 0; i < 40 && numLineSprites < MAX_SPRITES_PER_LINE; i++) {
+        int yPos = oam[i * 4] - 16;
+        if (currentScanline < yPos || currentScanline >= yPos + spriteHeight) {
+            continue;
+        }
 
-                setPixel(x, currentScanline, colorValue);
-            }
+        // Insertion sort by X, equal X keeps OAM order
+        LineSprite sprite{static_cast<int16_t>(oam[i * 4 + 1] - 8), i};
+        int position = numLineSprites++;
+        while (position > 0 && lineSprites[position - 1].x > sprite.x) {
+            lineSprites[position] = lineSprites[position - 1];
+            position--;
         }
+        lineSprites[position] = sprite;
     }
 }
 
-void PPU::drawSprites() {
-    uint8_t lcdControlValue = bus.read(LCDC_ADDRESS);
-    bool spriteDisplayEnable = static_cast<bool>((lcdControlValue >> 1) & 1);
-    if (!spriteDisplayEnable) {
+void PPU::drawSprites(const LineRegisters& registers, const uint8_t* colors, uint8_t* line) {
+    bool spriteDisplayEnable = static_cast<bool>((registers.lcdc >> 1) & 1);
+    if (!spriteDisplayEnable || numLineSprites == 0) {
         return;
     }
 
-    bool spriteSize = static_cast<bool>((lcdControlValue >> 2) & 1); // 0: 8x8, 1: 8x16
+    bool spriteSize = static_cast<bool>((registers.lcdc >> 2) & 1); // 0: 8x8, 1: 8x16
     uint8_t spriteHeight = spriteSize ? 16 : 8;
 
-    uint8_t currentScanline = bus.read(LY_ADDRESS);
+    // The first opaque sprite pixel in priority order owns the dot, even when it ends
+    // up hidden behind the background
+    std::array<bool, SCREEN_WIDTH> covered{};
 
-    // OAM starts at 0xFE00 and contains 40 sprites, each 4 bytes long
-    for (uint16_t i = 0; i < 40; i++) {
-        uint16_t spriteAddress = 0xFE00 + (i * 4);
-        uint8_t yPos = bus.read(spriteAddress) - 16;
-        uint8_t xPos = bus.read(spriteAddress + 1) - 8;
-        uint8_t tileNumber = bus.read(spriteAddress + 2);
-        uint8_t attributes = bus.read(spriteAddress + 3);
+    for (int i = 0; i < numLineSprites; i++) {
+        const uint8_t* sprite = oam.data() + lineSprites[i].oamIndex * 4;
+        int xPos = lineSprites[i].x;
+        uint8_t tileNumber = sprite[2];
+        uint8_t attributes = sprite[3];
 
         bool bgAndWindowOverSprite = static_cast<bool>((attributes >> 7) & 1);
         bool yFlip = static_cast<bool>((attributes >> 6) & 1);
         bool xFlip = static_cast<bool>((attributes >> 5) & 1);
         uint8_t paletteNumber = static_cast<uint8_t>((attributes >> 4) & 1);
 
-        if (currentScanline >= yPos && currentScanline < (yPos + spriteHeight)) {
-            uint8_t tileY = currentScanline - yPos;
-            if (yFlip) {
-                tileY = spriteHeight - 1 - tileY;
+        uint8_t tileY = registers.ly - (sprite[0] - 16);
+        if (yFlip) {
+            tileY = spriteHeight - 1 - tileY;
+        }
+        if (spriteSize) {
+            tileNumber &= 0xFE; // 8x16 sprites ignore the lowest bit of the tile number
+        }
+
+        // 8x16 sprites continue into the following tile
+        const uint8_t* pixels = &tileCache[tileNumber + tileY / TILE_PIXEL_SIZE][(tileY % TILE_PIXEL_SIZE) * TILE_PIXEL_SIZE];
+        const Palette& palette = (paletteNumber == 0) ? registers.obp0 : registers.obp1;
+
+        for (int x = 0; x < TILE_PIXEL_SIZE; x++) {
+            int screenX = xPos + x;
+            if (screenX < 0 || screenX >= SCREEN_WIDTH || covered[screenX]) {
+                continue;
             }
 
-            uint16_t tileAddress = TILE_BLOCK_0_START + (TILE_BYTE_SIZE * tileNumber);
-            uint8_t tileByte1 = bus.read(tileAddress + (2 * tileY));
-            uint8_t tileByte2 = bus.read(tileAddress + (2 * tileY + 1));
+            uint8_t colorValue = pixels[xFlip ? TILE_PIXEL_SIZE - 1 - x : x];
+            if (colorValue == 0) { // Color 0 is transparent
+                continue;
+            }
 
-            for (int x = 0; x < TILE_PIXEL_SIZE; x++) {
-                uint8_t tileX = x;
-                if (xFlip) {
-                    tileX = TILE_PIXEL_SIZE - 1 - tileX;
-                }
+            covered[screenX] = true;
+            if (bgAndWindowOverSprite && colors[screenX] != 0) {
+                continue;
+            }
+            std::memcpy(line + screenX * 4, palette[colorValue].data(), 4);
+        }
+    }
+}
 
-                uint8_t upperColorBit = (tileByte1 >> (7 - tileX)) & 1;
-                uint8_t lowerColorBit = (tileByte2 >> (7 - tileX)) & 1;
-                uint8_t colorValue = (upperColorBit << 1) | lowerColorBit;
+bool PPU::isWindowVisible(const LineRegisters& registers) const {
+    bool windowDisplayEnable = static_cast<bool>((registers.lcdc >> 5) & 1);
+    uint8_t wx = registers.wx - 7;
+    return windowDisplayEnable && windowTriggered && wx < SCREEN_WIDTH;
+}
 
-                if (colorValue == 0) { // Color 0 is transparent
-                    continue;
-                }
+int PPU::getSpriteFetchDots(int spriteX, uint8_t scx, int& lastPenalizedTile) {
+    if (spriteX == -TILE_PIXEL_SIZE) {
+        return OFFSCREEN_SPRITE_DOTS;
+    }
 
-                uint8_t palette = (paletteNumber == 0) ? bus.read(OBP0_ADDRESS) : bus.read(OBP1_ADDRESS);
-                uint8_t color = (palette >> (colorValue * 2)) & 0x3;
+    // The fetcher has to finish the background tile under the sprite first, which
+    // takes longer the closer the sprite is to that tile's left edge
+    int dots = SPRITE_FETCH_DOTS;
+    int bgX = spriteX + scx;
+    int tile = bgX >> 3;
+    if (tile != lastPenalizedTile) {
+        lastPenalizedTile = tile;
+        dots += std::max(5 - (bgX & (TILE_PIXEL_SIZE - 1)), 0);
+    }
+    return dots;
+}
 
-                uint8_t rgbValue;
-                switch (color) {
-                    case 0x00: rgbValue = 0; break; // black
-                    case 0x01: rgbValue = 96; break;
-                    case 0x02: rgbValue = 192; break;
-                    case 0x03: rgbValue = 255; break; //
-                    default: throw std::out_of_range("Color value exceeds 2 bits - should not even be reachable");
-                }
+int PPU::computePixelTransferDots(const LineRegisters& registers) const {
+    int dots = PIXEL_TRANSFER_DOTS + registers.scx % TILE_PIXEL_SIZE;
+    if (isWindowVisible(registers)) {
+        dots += WINDOW_FETCH_DOTS;
+    }
+
+    bool spriteDisplayEnable = static_cast<bool>((registers.lcdc >> 1) & 1);
+    if (spriteDisplayEnable) {
+        int lastPenalizedTile = std::numeric_limits<int>::min();
+        for (int i = 0; i < numLineSprites && lineSprites[i].x < SCREEN_WIDTH; i++) {
+            dots += getSpriteFetchDots(lineSprites[i].x, registers.scx, lastPenalizedTile);
+        }
+    }
+    return dots;
+}
+
+void PPU::startPixelFifo(uint64_t time) {
+    // Writes from before this point are already in the registers read here
+    registerLog.writes.clear();
+    fifo.registers = readLineRegisters();
+    fifo.startTime = time;
+    fifo.nextWrite = 0;
+    fifo.dot = 0;
+    fifo.x = 0;
+    fifo.discard = fifo.registers.scx % TILE_PIXEL_SIZE;
+    fifo.stall = 0;
+    fifo.fetcherX = 0;
+    fifo.lastPenalizedTile = std::numeric_limits<int>::min();
+    fifo.nextSprite = 0;
+    fifo.windowActive = false;
+    fifo.bgCount = 0;
+    fifo.spritePixels.fill(0);
+
+    pixelTransferDots = PIXEL_TRANSFER_DOTS + fifo.discard;
+}
+
+bool PPU::runPixelFifo(uint64_t time) {
+    updateTileCache();
+    uint8_t* line = frames.getBackBuffer().data() + fifo.registers.ly * SCREEN_WIDTH * 4;
+
+    while (fifo.x < SCREEN_WIDTH && fifo.startTime + fifo.dot < time) {
+        uint64_t dotTime = fifo.startTime + fifo.dot;
+        while (fifo.nextWrite < registerLog.writes.size() && registerLog.writes[fifo.nextWrite].time <= dotTime) {
+            const RenderRegisterLog::Write& write = registerLog.writes[fifo.nextWrite++];
+            applyRegisterWrite(write.address, write.value);
+        }
+
+        fifo.dot++;
+        if (fifo.dot <= FETCHER_STARTUP_DOTS) {
+            continue;
+        }
+        if (fifo.stall > 0) {
+            fifo.stall--;
+            continue;
+        }
 
-                int screenX = xPos + x;
-                if (screenX >= 0 && screenX < SCREEN_WIDTH) {
-                    int screenOffset = (currentScanline * SCREEN_WIDTH + screenX) * 4;
-                    frameBuffer[screenOffset] = rgbValue;
-                    frameBuffer[screenOffset + 1] = rgbValue;
-                    frameBuffer[screenOffset + 2] = rgbValue;
-                    frameBuffer[screenOffset + 3] = 255;
+        // Window and sprite fetches stop the pixel output while they run, this dot
+        // included. Neither can start while the first tile is still being scrolled off
+        if (fifo.discard == 0) {
+            if (!fifo.windowActive && isWindowVisible(fifo.registers) && fifo.x == fifo.registers.wx - 7) {
+                fifo.windowActive = true;
+                fifo.fetcherX = 0;
+                fifo.bgCount = 0;
+                fifo.stall = WINDOW_FETCH_DOTS - 1;
+                continue;
+            }
+
+            bool spriteDisplayEnable = static_cast<bool>((fifo.registers.lcdc >> 1) & 1);
+            bool fetchedSprite = false;
+            while (!fetchedSprite && fifo.nextSprite < numLineSprites && lineSprites[fifo.nextSprite].x <= fifo.x) {
+                const LineSprite& sprite = lineSprites[fifo.nextSprite++];
+                if (spriteDisplayEnable) {
+                    loadFifoSprite(sprite);
+                    fifo.stall = getSpriteFetchDots(sprite.x, fifo.registers.scx, fifo.lastPenalizedTile) - 1;
+                    fetchedSprite = true;
                 }
             }
+            if (fetchedSprite) {
+                continue;
+            }
         }
+
+        if (fifo.bgCount == 0) {
+            fetchFifoTile();
+        }
+        if (fifo.discard > 0) {
+            fifo.bgCount--;
+            fifo.discard--;
+            continue;
+        }
+        outputFifoPixel(line);
+    }
+
+    if (fifo.x < SCREEN_WIDTH) {
+        return false;
+    }
+    if (fifo.windowActive) {
+        windowLine++;
+    }
+    return true;
+}
+
+void PPU::applyRegisterWrite(uint16_t address, uint8_t value) {
+    LineRegisters& registers = fifo.registers;
+    switch (address) {
+        case LCDC_ADDRESS: registers.lcdc = value; break;
+        case SCY_ADDRESS: registers.scy = value; break;
+        case SCX_ADDRESS: registers.scx = value; break;
+        case WY_ADDRESS: registers.wy = value; break;
+        case WX_ADDRESS: registers.wx = value; break;
+        case BGP_ADDRESS: registers.bgp = decodePalette(value); break;
+        case OBP0_ADDRESS: registers.obp0 = decodePalette(value); break;
+        case OBP1_ADDRESS: registers.obp1 = decodePalette(value); break;
+        default: break;
+    }
+}
+
+void PPU::fetchFifoTile() {
+    const LineRegisters& registers = fifo.registers;
+
+    // Tile map and addressing mode are read from LCDC on every fetch
+    uint16_t tileMapStart;
+    uint8_t tileMapY;
+    int column;
+    if (fifo.windowActive) {
+        bool windowTileMapDisplaySelect = static_cast<bool>((registers.lcdc >> 6) & 1);
+        tileMapStart = windowTileMapDisplaySelect ? TILE_MAP_1_START : TILE_MAP_0_START;
+        tileMapY = windowLine;
+        column = fifo.fetcherX % NUM_TILES_PER_ROW;
+    } else {
+        bool tileMapMode = static_cast<bool>((registers.lcdc >> 3) & 1);
+        tileMapStart = tileMapMode ? TILE_MAP_1_START : TILE_MAP_0_START;
+        tileMapY = registers.ly + registers.scy;
+        column = (registers.scx / TILE_PIXEL_SIZE + fifo.fetcherX) % NUM_TILES_PER_ROW;
     }
-}
\ No newline at end of file
+    fifo.fetcherX++;
+
+    uint8_t tileNumber = vram[(tileMapStart - TILE_BLOCK_0_START) +
+        NUM_TILES_PER_COLUMN * (tileMapY / TILE_PIXEL_SIZE) + column];
+    std::memcpy(fifo.bgPixels.data(), getTileRow(registers.lcdc, tileNumber, tileMapY % TILE_PIXEL_SIZE), TILE_PIXEL_SIZE);
+    fifo.bgCount = TILE_PIXEL_SIZE;
+}
+
+void PPU::loadFifoSprite(const LineSprite& lineSprite) {
+    const uint8_t* sprite = oam.data() + lineSprite.oamIndex * 4;
+    bool spriteSize = static_cast<bool>((fifo.registers.lcdc >> 2) & 1); // 0: 8x8, 1: 8x16
+    uint8_t spriteHeight = spriteSize ? 16 : 8;
+    uint8_t tileNumber = sprite[2];
+    uint8_t attributes = sprite[3];
+
+    bool yFlip = static_cast<bool>((attributes >> 6) & 1);
+    bool xFlip = static_cast<bool>((attributes >> 5) & 1);
+    // Palette and BG priority, in the bit positions spritePixels keeps them in
+    uint8_t flags = static_cast<uint8_t>(((attributes >> 2) & 0x04) | ((attributes >> 4) & 0x08));
+
+    uint8_t tileY = fifo.registers.ly - (sprite[0] - 16);
+    if (yFlip) {
+        tileY = spriteHeight - 1 - tileY;
+    }
+    if (spriteSize) {
+        tileNumber &= 0xFE; // 8x16 sprites ignore the lowest bit of the tile number
+    }
+    const uint8_t* pixels = &tileCache[tileNumber + tileY / TILE_PIXEL_SIZE][(tileY % TILE_PIXEL_SIZE) * TILE_PIXEL_SIZE];
+
+    // Sprites fetched earlier keep the pixels they are opaque on
+    for (int x = 0; x < TILE_PIXEL_SIZE; x++) {
+        int screenX = lineSprite.x + x;
+        if (screenX < fifo.x || screenX >= SCREEN_WIDTH || fifo.spritePixels[screenX] != 0) {
+            continue;
+        }
+        uint8_t colorValue = pixels[xFlip ? TILE_PIXEL_SIZE - 1 - x : x];
+        if (colorValue != 0) {
+            fifo.spritePixels[screenX] = colorValue | flags;
+        }
+    }
+}
+
+void PPU::outputFifoPixel(uint8_t* line) {
+    const LineRegisters& registers = fifo.registers;
+    uint8_t color = fifo.bgPixels[TILE_PIXEL_SIZE - fifo.bgCount];
+    fifo.bgCount--;
+
+    // Palettes are applied as the pixel leaves the FIFO
+    const uint8_t* rgba = registers.bgp[color].data();
+    uint8_t sprite = fifo.spritePixels[fifo.x];
+    if (sprite != 0) {
+        bool bgAndWindowOverSprite = static_cast<bool>((sprite >> 3) & 1);
+        if (!bgAndWindowOverSprite || color == 0) {
+            const Palette& palette = ((sprite >> 2) & 1) ? registers.obp1 : registers.obp0;
+            rgba = palette[sprite & 0x3].data();
+        }
+    }
+    std::memcpy(line + fifo.x * 4, rgba, 4);
+    fifo.x++;
+}
@@ -0,0 +1,160 @@
+#include "rewind_buffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    void writeVarint(std::vector<uint8_t>& out, size_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    size_t readVarint(const uint8_t*& data) {
+        size_t value = 0;
+        for (int shift = 0; ; shift += 7) {
+            uint8_t byte = *data++;
+            value |= static_cast<size_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+    }
+
+    // Length of the run of equal bytes at the start of the two, at most size
+    size_t countEqual(const uint8_t* a, const uint8_t* b, size_t size) {
+        size_t count = 0;
+        for (; count + sizeof(uint64_t) <= size; count += sizeof(uint64_t)) {
+            uint64_t wordA;
+            uint64_t wordB;
+            std::memcpy(&wordA, a + count, sizeof(wordA));
+            std::memcpy(&wordB, b + count, sizeof(wordB));
+            if (wordA != wordB) {
+                break;
+            }
+        }
+        while (count < size && a[count] == b[count]) {
+            count++;
+        }
+        return count;
+    }
+} // namespace
+
+RewindBuffer::RewindBuffer(size_t memoryBudget, int framesPerSnapshot) :
+    memoryBudget(memoryBudget), framesPerSnapshot(std::max(framesPerSnapshot, 1)) {}
+
+void RewindBuffer::encodeDelta(const uint8_t* newer, const uint8_t* older, size_t size, size_t memoryOffset,
+                               uint64_t dirtyPages, std::vector<uint8_t>& delta) {
+    // Start of the next page known to be clean, in state order (VRAM comes before WRAM)
+    int page = 0;
+    auto nextCleanPage = [&]() {
+        for (; page < 2 * DirtyPages::PAGES_PER_BANK; page++) {
+            if (!(dirtyPages & (1ull << page))) {
+                size_t bankOffset = page < DirtyPages::PAGES_PER_BANK ?
+                    MMU::VRAM_STATE_OFFSET : MMU::WRAM_STATE_OFFSET;
+                return memoryOffset + bankOffset + (page % DirtyPages::PAGES_PER_BANK) * DirtyPages::PAGE_SIZE;
+            }
+        }
+        return size;
+    };
+    size_t cleanStart = nextCleanPage();
+
+    size_t zeros = 0;
+    size_t position = 0;
+    while (position < size) {
+        if (position == cleanStart) {
+            zeros += DirtyPages::PAGE_SIZE;
+            position += DirtyPages::PAGE_SIZE;
+            page++;
+            cleanStart = nextCleanPage();
+            continue;
+        }
+        size_t equal = countEqual(newer + position, older + position, cleanStart - position);
+        zeros += equal;
+        position += equal;
+        if (position == cleanStart) {
+            continue;
+        }
+
+        // A literal runs until MIN_ZERO_RUN equal bytes in a row or a clean page
+        size_t literalEnd = position + 1;
+        while (literalEnd < cleanStart) {
+            size_t run = countEqual(newer + literalEnd, older + literalEnd,
+                                    std::min(MIN_ZERO_RUN, cleanStart - literalEnd));
+            if (run == MIN_ZERO_RUN || literalEnd + run == cleanStart) {
+                break;
+            }
+            literalEnd += run + 1;
+        }
+
+        writeVarint(delta, zeros);
+        writeVarint(delta, literalEnd - position);
+        for (; position < literalEnd; position++) {
+            delta.push_back(newer[position] ^ older[position]);
+        }
+        zeros = 0;
+    }
+    // Trailing zeros are implied
+}
+
+void RewindBuffer::applyDelta(const std::vector<uint8_t>& delta, std::vector<uint8_t>& state) {
+    const uint8_t* data = delta.data();
+    const uint8_t* end = data + delta.size();
+    uint8_t* position = state.data();
+    while (data < end) {
+        position += readVarint(data);
+        size_t literal = readVarint(data);
+        for (size_t i = 0; i < literal; i++) {
+            position[i] ^= data[i];
+        }
+        position += literal;
+        data += literal;
+    }
+}
+
+void RewindBuffer::captureFrame(Gameboy& emu) {
+    if (++framesSinceSnapshot < framesPerSnapshot) {
+        return;
+    }
+    framesSinceSnapshot = 0;
+
+    next.clear();
+    size_t memoryOffset;
+    emu.saveState(next, &memoryOffset);
+    uint64_t dirtyPages = emu.takeDirtyMemoryPages();
+
+    if (head.size() == next.size()) {
+        std::vector<uint8_t> delta;
+        encodeDelta(next.data(), head.data(), head.size(), memoryOffset, dirtyPages, delta);
+        delta.shrink_to_fit();
+        deltaBytes += delta.size();
+        deltas.push_back(std::move(delta));
+    }
+    head.swap(next);
+
+    while (getMemoryUsed() > memoryBudget && !deltas.empty()) {
+        deltaBytes -= deltas.front().size();
+        deltas.pop_front();
+    }
+}
+
+bool RewindBuffer::rewind(Gameboy& emu) {
+    if (deltas.empty()) {
+        return false;
+    }
+    applyDelta(deltas.back(), head);
+    deltaBytes -= deltas.back().size();
+    deltas.pop_back();
+    emu.loadState(head.data(), head.size());
+    framesSinceSnapshot = 0;
+    return true;
+}
+
+void RewindBuffer::clear() {
+    head.clear();
+    deltas.clear();
+    deltaBytes = 0;
+    framesSinceSnapshot = 0;
+}
@@ -0,0 +1,50 @@
+#include "scheduler.hpp"
+
+Scheduler::Scheduler() {
+    deadlines.fill(NEVER);
+}
+
+void Scheduler::updateNextDeadline() {
+    nextDeadline = NEVER;
+    for (uint64_t deadline : deadlines) {
+        if (deadline < nextDeadline) {
+            nextDeadline = deadline;
+        }
+    }
+}
+
+void Scheduler::scheduleAt(EventType type, uint64_t time) {
+    deadlines[static_cast<size_t>(type)] = time;
+    updateNextDeadline();
+}
+
+void Scheduler::cancel(EventType type) {
+    deadlines[static_cast<size_t>(type)] = NEVER;
+    updateNextDeadline();
+}
+
+Event Scheduler::popEvent() {
+    // Ties go to the lowest event type so dispatch order is deterministic
+    size_t earliest = 0;
+    for (size_t i = 1; i < NUM_EVENT_TYPES; i++) {
+        if (deadlines[i] < deadlines[earliest]) {
+            earliest = i;
+        }
+    }
+
+    Event event{static_cast<EventType>(earliest), deadlines[earliest]};
+    deadlines[earliest] = NEVER;
+    updateNextDeadline();
+    return event;
+}
+
+void Scheduler::saveState(StateWriter& state) const {
+    state.write(currentCycle);
+    state.write(deadlines);
+}
+
+void Scheduler::loadState(StateReader& state) {
+    state.read(currentCycle);
+    state.read(deadlines);
+    updateNextDeadline();
+}
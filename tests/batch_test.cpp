@@ -0,0 +1,69 @@
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cartridge.hpp"
+
+namespace fs = std::filesystem;
+
+// Runs gameboy_batch on a manifest with a ROM whose header has an unknown RAM size code
+// next to a good one, and fails unless the bad job is reported as an error while the
+// good one still runs - a malformed cartridge must not take down the whole batch
+// Usage: ./batch_test {gameboy_batch} {rom} {work directory}
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: ./batch_test {gameboy_batch} {rom} {work directory}" << std::endl;
+        return 2;
+    }
+    std::string batch = argv[1];
+    std::string fileName = argv[2];
+    fs::path directory = argv[3];
+    constexpr size_t RAM_SIZE_ADDRESS = 0x149;
+    constexpr uint8_t UNKNOWN_RAM_SIZE = 0x09;
+
+    fs::create_directories(directory);
+    std::vector<uint8_t> rom = readRomFile(fileName);
+    auto writeRom = [&](const std::string& name) {
+        std::ofstream file(directory / name, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(rom.data()), rom.size());
+    };
+    writeRom("good.gb");
+    rom[RAM_SIZE_ADDRESS] = UNKNOWN_RAM_SIZE;
+    writeRom("bad.gb");
+    std::ofstream(directory / "jobs.txt") << "bad.gb 60\ngood.gb 60\n";
+
+    fs::path csv = directory / "stdout.csv";
+    std::string command = "\"" + batch + "\" \"" + (directory / "jobs.txt").string() + "\" --threads 2 > \"" +
+                          csv.string() + "\"";
+    int status = std::system(command.c_str());
+
+    std::ifstream output(csv);
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(output, line)) {
+        lines.push_back(line);
+    }
+    if (lines.size() != 3) {
+        std::cerr << "expected a header and two jobs, got " << lines.size() << " lines" << std::endl;
+        return 1;
+    }
+    if (lines[1].find("Unknown RAM size code") == std::string::npos) {
+        std::cerr << "bad header not reported: " << lines[1] << std::endl;
+        return 1;
+    }
+    if (lines[2].find("\"ok\"") == std::string::npos) {
+        std::cerr << "good ROM failed: " << lines[2] << std::endl;
+        return 1;
+    }
+    if (status == 0) {
+        std::cerr << "gameboy_batch exited with 0 despite a failed job" << std::endl;
+        return 1;
+    }
+
+    std::cout << "bad header reported, good ROM ran" << std::endl;
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cartridge.hpp"
+#include "frame_sink.hpp"
+#include "gameboy.hpp"
+
+// Runs a ROM under the interpreter and the JIT side by side and fails on the first
+// frame their save states differ - the JIT has to stay cycle-identical, which equal
+// frames alone don't show. Start is pressed now and then to get past title screens
+// Usage: ./jit_state_test {rom} [frames]
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: ./jit_state_test {rom} [frames]" << std::endl;
+        return 2;
+    }
+    std::string fileName = argv[1];
+    long numFrames = argc > 2 ? std::stol(argv[2]) : 3000;
+    constexpr uint8_t START_BUTTON = 7;
+    constexpr long START_PRESS_INTERVAL = 200;
+
+    Cartridge interpretedCartridge(readRomFile(fileName), fileName);
+    Cartridge compiledCartridge(readRomFile(fileName), fileName);
+    NullFrameSink sink;
+    Gameboy interpreted(interpretedCartridge, sink);
+    Gameboy compiled(compiledCartridge, sink);
+    interpreted.setJitEnabled(false);
+    compiled.setJitEnabled(true);
+
+    std::vector<uint8_t> interpretedState;
+    std::vector<uint8_t> compiledState;
+    for (long frame = 0; frame < numFrames; frame++) {
+        for (Gameboy* emu : {&interpreted, &compiled}) {
+            if (frame % START_PRESS_INTERVAL == START_PRESS_INTERVAL - 10) {
+                emu->handleKeyDown(START_BUTTON);
+            } else if (frame % START_PRESS_INTERVAL == 0) {
+                emu->handleKeyUp(START_BUTTON);
+            }
+            emu->runFrame();
+        }
+
+        interpretedState.clear();
+        compiledState.clear();
+        interpreted.saveState(interpretedState);
+        compiled.saveState(compiledState);
+        if (interpretedState != compiledState) {
+            size_t offset = 0;
+            while (offset < interpretedState.size() && offset < compiledState.size() &&
+                   interpretedState[offset] == compiledState[offset]) {
+                offset++;
+            }
+            std::cerr << fileName << ": states differ after frame " << frame << " at byte " << offset
+                      << " (" << interpreted.getInstructionCount() << " vs " << compiled.getInstructionCount()
+                      << " instructions)" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << fileName << ": identical for " << numFrames << " frames, "
+              << interpreted.getInstructionCount() << " instructions" << std::endl;
+    return 0;
+}